@@ -0,0 +1,9 @@
+/*
+ * Placeholder application key for builds against the offline libspotify
+ * stand-in, which does not check it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t g_appkey[] = { 0x01 };
+const size_t g_appkey_size = sizeof(g_appkey);
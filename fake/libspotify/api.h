@@ -0,0 +1,264 @@
+/**
+ * Offline stand-in for the libspotify public API header.
+ *
+ * Only the subset of the real <libspotify/api.h> (API version 12) that px
+ * uses is declared here.  Type names, enum values, structure layouts and
+ * function signatures follow the real header so that the same sources
+ * compile against either one.  The implementation lives in fake/spotify.c
+ * and serves a synthetic catalogue instead of talking to Spotify.
+ */
+
+#ifndef PUBLIC_API_H
+#define PUBLIC_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_LIBEXPORT(x) x
+
+#define SPOTIFY_API_VERSION 12
+
+/* --- Opaque types --- */
+typedef struct sp_session sp_session;
+typedef struct sp_track sp_track;
+typedef struct sp_album sp_album;
+typedef struct sp_artist sp_artist;
+typedef struct sp_link sp_link;
+typedef struct sp_playlist sp_playlist;
+typedef struct sp_playlistcontainer sp_playlistcontainer;
+typedef struct sp_user sp_user;
+
+typedef enum sp_error {
+	SP_ERROR_OK                        = 0,
+	SP_ERROR_BAD_API_VERSION           = 1,
+	SP_ERROR_API_INITIALIZATION_FAILED = 2,
+	SP_ERROR_TRACK_NOT_PLAYABLE        = 3,
+	SP_ERROR_BAD_APPLICATION_KEY       = 5,
+	SP_ERROR_BAD_USERNAME_OR_PASSWORD  = 6,
+	SP_ERROR_USER_BANNED               = 7,
+	SP_ERROR_UNABLE_TO_CONTACT_SERVER  = 8,
+	SP_ERROR_CLIENT_TOO_OLD            = 9,
+	SP_ERROR_OTHER_PERMANENT           = 10,
+	SP_ERROR_BAD_USER_AGENT            = 11,
+	SP_ERROR_MISSING_CALLBACK          = 12,
+	SP_ERROR_INVALID_INDATA            = 13,
+	SP_ERROR_INDEX_OUT_OF_RANGE        = 14,
+	SP_ERROR_USER_NEEDS_PREMIUM        = 15,
+	SP_ERROR_OTHER_TRANSIENT           = 16,
+	SP_ERROR_IS_LOADING                = 17,
+	SP_ERROR_NO_STREAM_AVAILABLE       = 18,
+	SP_ERROR_PERMISSION_DENIED         = 19,
+	SP_ERROR_INBOX_IS_FULL             = 20,
+	SP_ERROR_NO_CACHE                  = 21,
+	SP_ERROR_NO_SUCH_USER              = 22,
+	SP_ERROR_NO_CREDENTIALS            = 23,
+	SP_ERROR_NETWORK_DISABLED          = 24,
+	SP_ERROR_INVALID_DEVICE_ID         = 25,
+	SP_ERROR_CANT_OPEN_TRACE_FILE      = 26,
+	SP_ERROR_APPLICATION_BANNED        = 27,
+	SP_ERROR_OFFLINE_TOO_MANY_TRACKS   = 31,
+	SP_ERROR_OFFLINE_DISK_CACHE        = 32,
+	SP_ERROR_OFFLINE_EXPIRED           = 33,
+	SP_ERROR_OFFLINE_NOT_ALLOWED       = 34,
+	SP_ERROR_OFFLINE_LICENSE_LOST      = 35,
+	SP_ERROR_OFFLINE_LICENSE_ERROR     = 36,
+	SP_ERROR_LASTFM_AUTH_ERROR         = 39,
+	SP_ERROR_INVALID_ARGUMENT          = 40,
+	SP_ERROR_SYSTEM_FAILURE            = 41,
+} sp_error;
+
+SP_LIBEXPORT(const char*) sp_error_message(sp_error error);
+
+/* --- Session handling --- */
+typedef enum sp_connectionstate {
+	SP_CONNECTION_STATE_LOGGED_OUT   = 0,
+	SP_CONNECTION_STATE_LOGGED_IN    = 1,
+	SP_CONNECTION_STATE_DISCONNECTED = 2,
+	SP_CONNECTION_STATE_UNDEFINED    = 3,
+	SP_CONNECTION_STATE_OFFLINE      = 4
+} sp_connectionstate;
+
+typedef enum sp_sampletype {
+	SP_SAMPLETYPE_INT16_NATIVE_ENDIAN = 0,
+} sp_sampletype;
+
+typedef struct sp_audioformat {
+	sp_sampletype sample_type;
+	int sample_rate;
+	int channels;
+} sp_audioformat;
+
+typedef struct sp_audio_buffer_stats {
+	int samples;
+	int stutter;
+} sp_audio_buffer_stats;
+
+typedef struct sp_session_callbacks {
+	void (*logged_in)(sp_session *session, sp_error error);
+	void (*logged_out)(sp_session *session);
+	void (*metadata_updated)(sp_session *session);
+	void (*connection_error)(sp_session *session, sp_error error);
+	void (*message_to_user)(sp_session *session, const char *message);
+	void (*notify_main_thread)(sp_session *session);
+	int (*music_delivery)(sp_session *session, const sp_audioformat *format, const void *frames, int num_frames);
+	void (*play_token_lost)(sp_session *session);
+	void (*log_message)(sp_session *session, const char *data);
+	void (*end_of_track)(sp_session *session);
+	void (*streaming_error)(sp_session *session, sp_error error);
+	void (*userinfo_updated)(sp_session *session);
+	void (*start_playback)(sp_session *session);
+	void (*stop_playback)(sp_session *session);
+	void (*get_audio_buffer_stats)(sp_session *session, sp_audio_buffer_stats *stats);
+	void (*offline_status_updated)(sp_session *session);
+	void (*offline_error)(sp_session *session, sp_error error);
+	void (*credentials_blob_updated)(sp_session *session, const char *blob);
+	void (*connectionstate_updated)(sp_session *session);
+	void (*scrobble_error)(sp_session *session, sp_error error);
+	void (*private_session_mode_changed)(sp_session *session, bool is_private);
+} sp_session_callbacks;
+
+typedef struct sp_session_config {
+	int api_version;
+	const char *cache_location;
+	const char *settings_location;
+	const void *application_key;
+	size_t application_key_size;
+	const char *user_agent;
+	const sp_session_callbacks *callbacks;
+	void *userdata;
+	bool compress_playlists;
+	bool dont_save_metadata_for_playlists;
+	bool initially_unload_playlists;
+	const char *device_id;
+	const char *proxy;
+	const char *proxy_username;
+	const char *proxy_password;
+	const char *ca_certs_filename;
+	const char *tracefile;
+} sp_session_config;
+
+SP_LIBEXPORT(sp_error) sp_session_create(const sp_session_config *config, sp_session **sess);
+SP_LIBEXPORT(sp_error) sp_session_release(sp_session *sess);
+SP_LIBEXPORT(sp_error) sp_session_login(sp_session *session, const char *username, const char *password, bool remember_me, const char *blob);
+SP_LIBEXPORT(sp_error) sp_session_logout(sp_session *session);
+SP_LIBEXPORT(sp_connectionstate) sp_session_connectionstate(sp_session *session);
+SP_LIBEXPORT(void *) sp_session_userdata(sp_session *session);
+SP_LIBEXPORT(sp_error) sp_session_process_events(sp_session *session, int *next_timeout);
+SP_LIBEXPORT(sp_playlistcontainer *) sp_session_playlistcontainer(sp_session *session);
+
+/* --- Links (Spotify URIs) --- */
+typedef enum sp_linktype {
+	SP_LINKTYPE_INVALID  = 0,
+	SP_LINKTYPE_TRACK    = 1,
+	SP_LINKTYPE_ALBUM    = 2,
+	SP_LINKTYPE_ARTIST   = 3,
+	SP_LINKTYPE_SEARCH   = 4,
+	SP_LINKTYPE_PLAYLIST = 5,
+	SP_LINKTYPE_PROFILE  = 6,
+	SP_LINKTYPE_STARRED  = 7,
+	SP_LINKTYPE_LOCALTRACK = 8,
+	SP_LINKTYPE_IMAGE    = 9,
+} sp_linktype;
+
+SP_LIBEXPORT(sp_link *) sp_link_create_from_string(const char *link);
+SP_LIBEXPORT(sp_link *) sp_link_create_from_track(sp_track *track, int offset);
+SP_LIBEXPORT(sp_link *) sp_link_create_from_album(sp_album *album);
+SP_LIBEXPORT(sp_link *) sp_link_create_from_artist(sp_artist *artist);
+SP_LIBEXPORT(sp_link *) sp_link_create_from_playlist(sp_playlist *playlist);
+SP_LIBEXPORT(int) sp_link_as_string(sp_link *link, char *buffer, int buffer_size);
+SP_LIBEXPORT(sp_linktype) sp_link_type(sp_link *link);
+SP_LIBEXPORT(sp_error) sp_link_add_ref(sp_link *link);
+SP_LIBEXPORT(sp_error) sp_link_release(sp_link *link);
+
+/* --- Track subsystem --- */
+SP_LIBEXPORT(bool) sp_track_is_loaded(sp_track *track);
+SP_LIBEXPORT(sp_error) sp_track_error(sp_track *track);
+SP_LIBEXPORT(int) sp_track_num_artists(sp_track *track);
+SP_LIBEXPORT(sp_artist *) sp_track_artist(sp_track *track, int index);
+SP_LIBEXPORT(sp_album *) sp_track_album(sp_track *track);
+SP_LIBEXPORT(const char *) sp_track_name(sp_track *track);
+SP_LIBEXPORT(int) sp_track_duration(sp_track *track);
+SP_LIBEXPORT(sp_error) sp_track_add_ref(sp_track *track);
+SP_LIBEXPORT(sp_error) sp_track_release(sp_track *track);
+
+/* --- Album subsystem --- */
+SP_LIBEXPORT(bool) sp_album_is_loaded(sp_album *album);
+SP_LIBEXPORT(const char *) sp_album_name(sp_album *album);
+SP_LIBEXPORT(sp_error) sp_album_add_ref(sp_album *album);
+SP_LIBEXPORT(sp_error) sp_album_release(sp_album *album);
+
+/* --- Artist subsystem --- */
+SP_LIBEXPORT(const char *) sp_artist_name(sp_artist *artist);
+SP_LIBEXPORT(bool) sp_artist_is_loaded(sp_artist *artist);
+SP_LIBEXPORT(sp_error) sp_artist_add_ref(sp_artist *artist);
+SP_LIBEXPORT(sp_error) sp_artist_release(sp_artist *artist);
+
+/* --- Playlist subsystem --- */
+typedef struct sp_playlist_callbacks {
+	void (*tracks_added)(sp_playlist *pl, sp_track * const *tracks, int num_tracks, int position, void *userdata);
+	void (*tracks_removed)(sp_playlist *pl, const int *tracks, int num_tracks, void *userdata);
+	void (*tracks_moved)(sp_playlist *pl, const int *tracks, int num_tracks, int new_position, void *userdata);
+	void (*playlist_renamed)(sp_playlist *pl, void *userdata);
+	void (*playlist_state_changed)(sp_playlist *pl, void *userdata);
+	void (*playlist_update_in_progress)(sp_playlist *pl, bool done, void *userdata);
+	void (*playlist_metadata_updated)(sp_playlist *pl, void *userdata);
+	void (*track_created_changed)(sp_playlist *pl, int position, sp_user *user, int when, void *userdata);
+	void (*track_seen_changed)(sp_playlist *pl, int position, bool seen, void *userdata);
+	void (*description_changed)(sp_playlist *pl, const char *desc, void *userdata);
+	void (*image_changed)(sp_playlist *pl, const unsigned char *image, void *userdata);
+	void (*track_message_changed)(sp_playlist *pl, int position, const char *message, void *userdata);
+	void (*subscribers_changed)(sp_playlist *pl, void *userdata);
+} sp_playlist_callbacks;
+
+SP_LIBEXPORT(sp_playlist *) sp_playlist_create(sp_session *session, sp_link *link);
+SP_LIBEXPORT(bool) sp_playlist_is_loaded(sp_playlist *playlist);
+SP_LIBEXPORT(sp_error) sp_playlist_add_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata);
+SP_LIBEXPORT(sp_error) sp_playlist_remove_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata);
+SP_LIBEXPORT(int) sp_playlist_num_tracks(sp_playlist *playlist);
+SP_LIBEXPORT(sp_track *) sp_playlist_track(sp_playlist *playlist, int index);
+SP_LIBEXPORT(int) sp_playlist_track_create_time(sp_playlist *playlist, int index);
+SP_LIBEXPORT(sp_user *) sp_playlist_track_creator(sp_playlist *playlist, int index);
+SP_LIBEXPORT(const char *) sp_playlist_name(sp_playlist *playlist);
+SP_LIBEXPORT(sp_user *) sp_playlist_owner(sp_playlist *playlist);
+SP_LIBEXPORT(const char *) sp_playlist_get_description(sp_playlist *playlist);
+SP_LIBEXPORT(sp_error) sp_playlist_add_ref(sp_playlist *playlist);
+SP_LIBEXPORT(sp_error) sp_playlist_release(sp_playlist *playlist);
+
+/* --- Playlist container subsystem --- */
+typedef enum sp_playlist_type {
+	SP_PLAYLIST_TYPE_PLAYLIST     = 0,
+	SP_PLAYLIST_TYPE_START_FOLDER = 1,
+	SP_PLAYLIST_TYPE_END_FOLDER   = 2,
+	SP_PLAYLIST_TYPE_PLACEHOLDER  = 3,
+} sp_playlist_type;
+
+typedef struct sp_playlistcontainer_callbacks {
+	void (*playlist_added)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+	void (*playlist_removed)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, void *userdata);
+	void (*playlist_moved)(sp_playlistcontainer *pc, sp_playlist *playlist, int position, int new_position, void *userdata);
+	void (*container_loaded)(sp_playlistcontainer *pc, void *userdata);
+} sp_playlistcontainer_callbacks;
+
+SP_LIBEXPORT(sp_error) sp_playlistcontainer_add_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata);
+SP_LIBEXPORT(sp_error) sp_playlistcontainer_remove_callbacks(sp_playlistcontainer *pc, sp_playlistcontainer_callbacks *callbacks, void *userdata);
+SP_LIBEXPORT(int) sp_playlistcontainer_num_playlists(sp_playlistcontainer *pc);
+SP_LIBEXPORT(bool) sp_playlistcontainer_is_loaded(sp_playlistcontainer *pc);
+SP_LIBEXPORT(sp_playlist *) sp_playlistcontainer_playlist(sp_playlistcontainer *pc, int index);
+SP_LIBEXPORT(sp_playlist_type) sp_playlistcontainer_playlist_type(sp_playlistcontainer *pc, int index);
+SP_LIBEXPORT(sp_error) sp_playlistcontainer_add_ref(sp_playlistcontainer *pc);
+SP_LIBEXPORT(sp_error) sp_playlistcontainer_release(sp_playlistcontainer *pc);
+
+/* --- User handling --- */
+SP_LIBEXPORT(const char *) sp_user_canonical_name(sp_user *user);
+SP_LIBEXPORT(const char *) sp_user_display_name(sp_user *user);
+SP_LIBEXPORT(bool) sp_user_is_loaded(sp_user *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PUBLIC_API_H */
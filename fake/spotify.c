@@ -0,0 +1,1473 @@
+/*
+ * Offline stand-in for libspotify.
+ *
+ * Serves a synthetic, deterministic catalogue through the subset of the
+ * libspotify API that px uses, so px can be run and timed without a
+ * Spotify account.  Loading is simulated: the container, each playlist and
+ * each track become available a configurable latency after they are
+ * requested, and callbacks are delivered from sp_session_process_events()
+ * on the caller's thread, like the real library.  An internal "network"
+ * thread calls notify_main_thread when the next object is due.
+ *
+ * Everything is tuned through environment variables read when the session
+ * is created:
+ *
+ *   SPFAKE_SEED           catalogue seed (1)
+ *   SPFAKE_PLAYLISTS      playlists in the rootlist (5000)
+ *   SPFAKE_TRACKS         mean tracks per playlist (50)
+ *   SPFAKE_MAX_TRACKS     cap on tracks per playlist (10000)
+ *   SPFAKE_TRACK_POOL     distinct tracks (200000)
+ *   SPFAKE_ALBUMS         distinct albums (20000)
+ *   SPFAKE_ARTISTS        distinct artists (5000)
+ *   SPFAKE_USERS          distinct users (50)
+ *   SPFAKE_LATENCY        mean per-object load latency in ms (20)
+ *   SPFAKE_BATCH          tracks resolved per metadata round (50)
+ *   SPFAKE_TRACK_FAIL     fraction of tracks that never load (0)
+ *   SPFAKE_PLAYLIST_FAIL  fraction of playlists that never load (0)
+ *   SPFAKE_UNLOADED       fraction of playlists not loaded with the rootlist (0)
+ *   SPFAKE_EDITED         fraction of playlists edited by SPFAKE_EDIT_SEED (0)
+ *   SPFAKE_EDIT_SEED      which edits: runs with different seeds see
+ *                         different playlists changed (1)
+ *   SPFAKE_CAPACITY       playlists loading at once before latency starts to
+ *                         grow in proportion (0, unlimited)
+ *   SPFAKE_LIVE_EDITS     edits per second made to subscribed playlists once
+ *                         the rootlist has loaded, delivered through
+ *                         tracks_added/removed/moved (0)
+ *   SPFAKE_AUTH_MS        extra login time when authenticating with a
+ *                         password rather than a credentials blob (0)
+ *   SPFAKE_SYNC_MS        extra time to sync the rootlist when it isn't in
+ *                         the cache under cache_location yet (0)
+ *   SPFAKE_REPORT         file to append run statistics to at exit
+ *
+ * Every login hands a credentials blob to credentials_blob_updated, and a
+ * later login with that blob instead of a password is accepted.  Once the
+ * rootlist has loaded it is remembered in cache_location, so the next
+ * session with the same catalogue skips SPFAKE_SYNC_MS.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <libspotify/api.h>
+
+#define MAX_CALLBACKS 4
+#define MAX_ARTISTS 3
+#define MAX_EDIT 3
+#define NEVER UINT64_MAX
+
+struct sp_user {
+    char name[16];
+};
+
+struct sp_artist {
+    int id;
+    char name[24];
+};
+
+struct sp_album {
+    int id;
+    char name[24];
+};
+
+struct sp_track {
+    int id;
+    int duration;
+    int fail;
+    int num_artists;
+    sp_album *album;
+    sp_artist *artists[MAX_ARTISTS];
+    char name[24];
+    uint64_t ready_at;      /* 0 = not requested yet, guarded by g_lock */
+    int loaded;             /* atomic */
+};
+
+struct pl_entry {
+    int track;
+    int when;
+    int creator;
+};
+
+struct pl_callback {
+    sp_playlist_callbacks *cb;
+    void *userdata;
+};
+
+struct sp_playlist {
+    int id;
+    int fail;
+    int preloaded;
+    int num_tracks;
+    int refs;
+    struct pl_entry *entries;
+    sp_user *owner;
+    char name[32];
+    const char *description;
+
+    /* load state, guarded by g_lock except where noted */
+    int loaded;             /* atomic */
+    uint64_t ready_at;
+    uint64_t next_event;
+    int num_loaded;         /* tracks seen loaded at the last resolve */
+    int announce;
+    int in_active;
+    struct sp_playlist *next_active;
+    struct pl_callback cbs[MAX_CALLBACKS];
+    int ncbs;
+};
+
+struct sp_playlistcontainer {
+    int num;
+    sp_playlist *playlists;
+    sp_playlistcontainer_callbacks *cb;
+    void *userdata;
+    uint64_t ready_at;
+    int loaded;             /* atomic */
+    int refs;
+};
+
+struct sp_link {
+    sp_linktype type;
+    void *obj;
+    int refs;
+};
+
+enum { S_IDLE, S_LOGGING_IN, S_LOGGED_IN, S_LOGGED_OUT };
+
+struct sp_session {
+    sp_session_config config;
+    int state;
+    uint64_t login_at;
+    sp_error login_error;
+    char username[64];
+    sp_playlistcontainer pc;
+};
+
+/* --- Configuration --- */
+static struct {
+    unsigned long seed;
+    int playlists, tracks, max_tracks, track_pool;
+    int albums, artists, users, latency, batch, capacity, auth_ms, sync_ms;
+    double track_fail, playlist_fail, unloaded, edited, live_edits;
+    unsigned long edit_seed;
+    const char *report;
+} cfg;
+
+/* --- Catalogue --- */
+static sp_user *g_users;
+static sp_artist *g_artists;
+static sp_album *g_albums;
+static sp_track *g_tracks;
+static const char *g_descriptions[] = {
+    "Songs for the train", "Dinner party", "Loud", "Things to learn on guitar",
+};
+
+/* --- Runtime --- */
+static sp_session *g_session;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_net_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_net_thread;
+static uint64_t g_next_due;
+static sp_playlist *g_active;
+static int g_num_active;
+static uint64_t g_start;
+static uint64_t g_next_edit;
+
+static unsigned long g_links_created;       /* atomic */
+static unsigned long g_events_processed;    /* atomic */
+static unsigned long g_callbacks_fired;     /* atomic */
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* splitmix64 so every object is derived from (seed, kind, index) */
+static uint64_t
+mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t g_rng;
+
+static uint64_t
+rnd(void)
+{
+    g_rng = mix(g_rng);
+    return g_rng;
+}
+
+static double
+rnd_unit(void)
+{
+    return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+env_int(const char *name, int def)
+{
+    const char *v = getenv(name);
+    return v && *v ? atoi(v) : def;
+}
+
+static double
+env_double(const char *name, double def)
+{
+    const char *v = getenv(name);
+    return v && *v ? atof(v) : def;
+}
+
+/* per-object latency, jittered between 0.5x and 1.5x of the mean */
+static uint64_t
+latency(int kind, int id)
+{
+    uint64_t h = mix(cfg.seed ^ ((uint64_t)kind << 32) ^ (uint64_t)id);
+    return cfg.latency / 2 + (cfg.latency ? h % (cfg.latency + 1) : 0);
+}
+
+/* latency for a playlist or track request, slowed by the number in flight */
+static uint64_t
+load_latency(int kind, int id)
+{
+    uint64_t l = latency(kind, id);
+
+    if (cfg.capacity > 0 && g_num_active > cfg.capacity) {
+        l = l * g_num_active / cfg.capacity;
+    }
+    return l;
+}
+
+static void
+read_config(void)
+{
+    cfg.seed = env_int("SPFAKE_SEED", 1);
+    cfg.playlists = env_int("SPFAKE_PLAYLISTS", 5000);
+    cfg.tracks = env_int("SPFAKE_TRACKS", 50);
+    cfg.max_tracks = env_int("SPFAKE_MAX_TRACKS", 10000);
+    cfg.track_pool = env_int("SPFAKE_TRACK_POOL", 200000);
+    cfg.albums = env_int("SPFAKE_ALBUMS", 20000);
+    cfg.artists = env_int("SPFAKE_ARTISTS", 5000);
+    cfg.users = env_int("SPFAKE_USERS", 50);
+    cfg.latency = env_int("SPFAKE_LATENCY", 20);
+    cfg.batch = env_int("SPFAKE_BATCH", 50);
+    cfg.capacity = env_int("SPFAKE_CAPACITY", 0);
+    cfg.track_fail = env_double("SPFAKE_TRACK_FAIL", 0);
+    cfg.playlist_fail = env_double("SPFAKE_PLAYLIST_FAIL", 0);
+    cfg.unloaded = env_double("SPFAKE_UNLOADED", 0);
+    cfg.edited = env_double("SPFAKE_EDITED", 0);
+    cfg.edit_seed = env_int("SPFAKE_EDIT_SEED", 1);
+    cfg.live_edits = env_double("SPFAKE_LIVE_EDITS", 0);
+    cfg.auth_ms = env_int("SPFAKE_AUTH_MS", 0);
+    cfg.sync_ms = env_int("SPFAKE_SYNC_MS", 0);
+    cfg.report = getenv("SPFAKE_REPORT");
+
+    if (cfg.track_pool < 1) cfg.track_pool = 1;
+    if (cfg.albums < 1) cfg.albums = 1;
+    if (cfg.artists < 1) cfg.artists = 1;
+    if (cfg.users < 1) cfg.users = 1;
+    if (cfg.batch < 1) cfg.batch = 1;
+}
+
+static void
+build_catalogue(sp_playlistcontainer *pc)
+{
+    int i, j;
+
+    g_rng = cfg.seed;
+
+    g_users = calloc(cfg.users, sizeof(*g_users));
+    for (i = 0; i < cfg.users; i++) {
+        snprintf(g_users[i].name, sizeof(g_users[i].name), "user%d", i);
+    }
+
+    g_artists = calloc(cfg.artists, sizeof(*g_artists));
+    for (i = 0; i < cfg.artists; i++) {
+        g_artists[i].id = i;
+        snprintf(g_artists[i].name, sizeof(g_artists[i].name), "Artist %d", i);
+    }
+
+    g_albums = calloc(cfg.albums, sizeof(*g_albums));
+    for (i = 0; i < cfg.albums; i++) {
+        g_albums[i].id = i;
+        snprintf(g_albums[i].name, sizeof(g_albums[i].name), "Album %d", i);
+    }
+
+    g_tracks = calloc(cfg.track_pool, sizeof(*g_tracks));
+    for (i = 0; i < cfg.track_pool; i++) {
+        sp_track *t = &g_tracks[i];
+        t->id = i;
+        t->duration = 90000 + rnd() % 300000;
+        t->fail = rnd_unit() < cfg.track_fail;
+        t->album = &g_albums[rnd() % cfg.albums];
+        t->num_artists = 1 + (rnd() % 8 == 0) + (rnd() % 16 == 0);
+        for (j = 0; j < t->num_artists; j++) {
+            t->artists[j] = &g_artists[rnd() % cfg.artists];
+        }
+        snprintf(t->name, sizeof(t->name), "Track %d", i);
+    }
+
+    pc->num = cfg.playlists;
+    pc->playlists = calloc(cfg.playlists, sizeof(*pc->playlists));
+    for (i = 0; i < cfg.playlists; i++) {
+        sp_playlist *pl = &pc->playlists[i];
+        int n = (int)(-log(1.0 - rnd_unit()) * cfg.tracks);
+
+        if (n > cfg.max_tracks) n = cfg.max_tracks;
+        pl->id = i;
+        pl->fail = rnd_unit() < cfg.playlist_fail;
+        pl->preloaded = rnd_unit() >= cfg.unloaded;
+        pl->owner = &g_users[rnd() % cfg.users];
+        pl->description = rnd() % 3 == 0 ?
+            g_descriptions[rnd() % (sizeof(g_descriptions) / sizeof(g_descriptions[0]))] : NULL;
+        snprintf(pl->name, sizeof(pl->name), "Playlist %d", i);
+        pl->num_tracks = n;
+        pl->next_event = NEVER;
+        pl->entries = calloc(n ? n : 1, sizeof(*pl->entries));
+        for (j = 0; j < n; j++) {
+            pl->entries[j].track = rnd() % cfg.track_pool;
+            pl->entries[j].when = 1262304000 + rnd() % 100000000;
+            pl->entries[j].creator = rnd() % cfg.users;
+        }
+    }
+
+    /* edits come from their own stream, leaving the catalogue above as is */
+    if (cfg.edited <= 0) {
+        return;
+    }
+    g_rng = cfg.seed ^ (cfg.edit_seed * 0x9e3779b97f4a7c15ULL);
+    for (i = 0; i < cfg.playlists; i++) {
+        sp_playlist *pl = &pc->playlists[i];
+        struct pl_entry *en;
+
+        if (rnd_unit() >= cfg.edited) {
+            continue;
+        }
+        if (pl->num_tracks > 0 && rnd() % 2) {
+            /* swap a track for another, keeping the count */
+            pl->entries[rnd() % pl->num_tracks].track = rnd() % cfg.track_pool;
+            continue;
+        }
+        pl->entries = realloc(pl->entries, (pl->num_tracks + 1) * sizeof(*pl->entries));
+        en = &pl->entries[pl->num_tracks++];
+        en->track = rnd() % cfg.track_pool;
+        en->when = 1262304000 + 100000000 + rnd() % 1000000;
+        en->creator = rnd() % cfg.users;
+    }
+}
+
+static void
+report(void)
+{
+    FILE *f;
+    struct rusage ru;
+
+    if (!cfg.report || !(f = fopen(cfg.report, "a"))) {
+        return;
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(f, "wall_ms %llu\n", (unsigned long long)(now_ms() - g_start));
+    fprintf(f, "maxrss_kb %ld\n", ru.ru_maxrss);
+    fprintf(f, "links_created %lu\n", __atomic_load_n(&g_links_created, __ATOMIC_RELAXED));
+    fprintf(f, "process_events %lu\n", __atomic_load_n(&g_events_processed, __ATOMIC_RELAXED));
+    fprintf(f, "callbacks %lu\n", __atomic_load_n(&g_callbacks_fired, __ATOMIC_RELAXED));
+    fclose(f);
+}
+
+/* --- Simulated network --- */
+
+static void
+notify(void)
+{
+    const sp_session_callbacks *cb = g_session ? g_session->config.callbacks : NULL;
+    if (cb && cb->notify_main_thread) {
+        cb->notify_main_thread(g_session);
+    }
+}
+
+/* called with g_lock held */
+static void
+schedule(uint64_t when)
+{
+    if (when != NEVER && (g_next_due == 0 || when < g_next_due)) {
+        g_next_due = when;
+        pthread_cond_signal(&g_net_cond);
+    }
+}
+
+static void *
+net_thread(void *junk)
+{
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        uint64_t due = g_next_due;
+        if (due == 0) {
+            pthread_cond_wait(&g_net_cond, &g_lock);
+        } else if (now_ms() < due) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            due -= now_ms();
+            ts.tv_sec += due / 1000;
+            ts.tv_nsec += (due % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&g_net_cond, &g_lock, &ts);
+        } else {
+            g_next_due = 0;
+            pthread_mutex_unlock(&g_lock);
+            notify();
+            pthread_mutex_lock(&g_lock);
+        }
+    }
+    return NULL;
+}
+
+/* --- Event delivery --- */
+
+enum { EV_LOGGED_IN, EV_CREDENTIALS, EV_CONTAINER_LOADED, EV_STATE_CHANGED,
+       EV_METADATA_UPDATED, EV_TRACKS_ADDED, EV_TRACKS_REMOVED, EV_TRACKS_MOVED };
+
+struct event {
+    int kind;
+    sp_playlist *pl;
+
+    /* edits only, and n is the error for EV_LOGGED_IN */
+    int n, position;
+    int indices[MAX_EDIT];
+    sp_track *tracks[MAX_EDIT];
+};
+
+static struct event *g_events;
+static int g_nevents, g_events_cap;
+
+static struct event *
+push_event(int kind, sp_playlist *pl)
+{
+    struct event *ev;
+
+    if (g_nevents == g_events_cap) {
+        g_events_cap = g_events_cap ? 2 * g_events_cap : 64;
+        g_events = realloc(g_events, g_events_cap * sizeof(*g_events));
+    }
+    ev = &g_events[g_nevents++];
+    memset(ev, 0, sizeof(*ev));
+    ev->kind = kind;
+    ev->pl = pl;
+    return ev;
+}
+
+static void
+activate(sp_playlist *pl)
+{
+    if (!pl->in_active) {
+        pl->in_active = 1;
+        pl->next_active = g_active;
+        g_active = pl;
+        g_num_active++;
+    }
+}
+
+/* start resolving the playlist's tracks, batch by batch */
+static void
+request_tracks(sp_playlist *pl, uint64_t now)
+{
+    int j;
+    uint64_t next = NEVER;
+
+    for (j = 0; j < pl->num_tracks; j++) {
+        sp_track *t = &g_tracks[pl->entries[j].track];
+        uint64_t when;
+
+        if (t->fail) {
+            continue;
+        }
+        when = now + load_latency(3, t->id) * (1 + j / cfg.batch);
+        if (t->ready_at == 0 || when < t->ready_at) {
+            t->ready_at = when;
+        }
+        if (!__atomic_load_n(&t->loaded, __ATOMIC_RELAXED) && t->ready_at < next) {
+            next = t->ready_at;
+        }
+    }
+    pl->next_event = next;
+    schedule(next);
+}
+
+/*
+ * Mark due tracks loaded; returns non-zero if any of the playlist's tracks
+ * changed, including ones another playlist sharing them resolved first.
+ */
+static int
+resolve_tracks(sp_playlist *pl, uint64_t now)
+{
+    int j, loaded = 0, changed;
+    uint64_t next = NEVER;
+
+    for (j = 0; j < pl->num_tracks; j++) {
+        sp_track *t = &g_tracks[pl->entries[j].track];
+
+        if (__atomic_load_n(&t->loaded, __ATOMIC_RELAXED)) {
+            loaded++;
+            continue;
+        }
+        if (t->fail) {
+            continue;
+        }
+        if (t->ready_at && t->ready_at <= now) {
+            __atomic_store_n(&t->loaded, 1, __ATOMIC_RELEASE);
+            loaded++;
+        } else if (t->ready_at && t->ready_at < next) {
+            next = t->ready_at;
+        }
+    }
+    changed = loaded != pl->num_loaded;
+    pl->num_loaded = loaded;
+    pl->next_event = next;
+    schedule(next);
+    return changed;
+}
+
+static int
+cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* pick 1..MAX_EDIT distinct indices below n, in ascending order */
+static int
+pick_indices(int *out, int n)
+{
+    int k = 1 + rnd() % MAX_EDIT, i, j, m = 0;
+
+    if (k > n) k = n;
+    while (m < k) {
+        i = rnd() % n;
+        for (j = 0; j < m && out[j] != i; j++)
+            ;
+        if (j == m) {
+            out[m++] = i;
+        }
+    }
+    qsort(out, m, sizeof(*out), cmp_int);
+    return m;
+}
+
+/*
+ * Edit a random loaded playlist somebody is subscribed to, the way another
+ * client would: add, remove or move a few tracks.  Called with g_lock held.
+ */
+static void
+live_edit(sp_playlistcontainer *pc, uint64_t now)
+{
+    sp_playlist *pl = NULL;
+    struct pl_entry moved[MAX_EDIT];
+    struct event *ev;
+    int i, j, k, tries, op;
+
+    for (tries = 0; tries < 32 && pl == NULL; tries++) {
+        pl = &pc->playlists[rnd() % pc->num];
+        if (!__atomic_load_n(&pl->loaded, __ATOMIC_RELAXED) || pl->ncbs == 0) {
+            pl = NULL;
+        }
+    }
+    if (pl == NULL) {
+        return;
+    }
+
+    op = pl->num_tracks == 0 ? EV_TRACKS_ADDED : EV_TRACKS_ADDED + rnd() % 3;
+    ev = push_event(op, pl);
+
+    switch (op) {
+    case EV_TRACKS_ADDED:
+        ev->n = 1 + rnd() % MAX_EDIT;
+        ev->position = rnd() % (pl->num_tracks + 1);
+        pl->entries = realloc(pl->entries, (pl->num_tracks + ev->n) * sizeof(*pl->entries));
+        memmove(&pl->entries[ev->position + ev->n], &pl->entries[ev->position],
+                (pl->num_tracks - ev->position) * sizeof(*pl->entries));
+        for (i = 0; i < ev->n; i++) {
+            struct pl_entry *en = &pl->entries[ev->position + i];
+            en->track = rnd() % cfg.track_pool;
+            en->when = 1262304000 + 200000000 + (int)((now - g_start) / 1000);
+            en->creator = rnd() % cfg.users;
+            ev->tracks[i] = &g_tracks[en->track];
+        }
+        pl->num_tracks += ev->n;
+        request_tracks(pl, now);
+        activate(pl);
+        break;
+
+    case EV_TRACKS_REMOVED:
+        ev->n = pick_indices(ev->indices, pl->num_tracks);
+        for (i = 0, j = 0, k = 0; i < pl->num_tracks; i++) {
+            if (k < ev->n && ev->indices[k] == i) {
+                k++;
+            } else {
+                pl->entries[j++] = pl->entries[i];
+            }
+        }
+        pl->num_tracks = j;
+        break;
+
+    case EV_TRACKS_MOVED:
+        /* the moved tracks end up before the one originally at position */
+        ev->n = pick_indices(ev->indices, pl->num_tracks);
+        ev->position = rnd() % (pl->num_tracks + 1);
+        for (i = 0, j = 0, k = 0; i < pl->num_tracks; i++) {
+            if (k < ev->n && ev->indices[k] == i) {
+                moved[k++] = pl->entries[i];
+            } else {
+                pl->entries[j++] = pl->entries[i];
+            }
+        }
+        for (k = 0; k < ev->n && ev->indices[k] < ev->position; k++)
+            ;
+        i = ev->position - k;
+        memmove(&pl->entries[i + ev->n], &pl->entries[i],
+                (pl->num_tracks - ev->n - i) * sizeof(*pl->entries));
+        memcpy(&pl->entries[i], moved, ev->n * sizeof(*moved));
+        break;
+    }
+}
+
+/* --- Login and cache --- */
+
+/* the credentials blob handed out for a user, and accepted back in place of a password */
+static const char *
+make_blob(const char *username, char *blob, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *username; username++) {
+        h = (h ^ (unsigned char)*username) * 0x100000001b3ULL;
+    }
+    snprintf(blob, size, "spfake1:%016llx", (unsigned long long)mix(h));
+    return blob;
+}
+
+static int
+cache_path(sp_session *s, char *path, size_t size)
+{
+    const char *dir = s->config.cache_location;
+
+    if (dir == NULL || *dir == '\0') {
+        return -1;
+    }
+    snprintf(path, size, "%s/spfake-rootlist", dir);
+    return 0;
+}
+
+/* whether the rootlist of this catalogue is cached already; g_lock held */
+static int
+cache_is_warm(sp_session *s)
+{
+    char path[4096], line[64], want[64];
+    FILE *f;
+    int warm = 0;
+
+    if (cache_path(s, path, sizeof(path)) != 0 || !(f = fopen(path, "r"))) {
+        return 0;
+    }
+    snprintf(want, sizeof(want), "%lu %d\n", cfg.seed, cfg.playlists);
+    warm = fgets(line, sizeof(line), f) && strcmp(line, want) == 0;
+    fclose(f);
+    return warm;
+}
+
+static void
+cache_rootlist(sp_session *s)
+{
+    char path[4096];
+    FILE *f;
+
+    if (cache_path(s, path, sizeof(path)) != 0) {
+        return;
+    }
+    mkdir(s->config.cache_location, 0700);
+    if ((f = fopen(path, "w"))) {
+        fprintf(f, "%lu %d\n", cfg.seed, cfg.playlists);
+        fclose(f);
+    }
+}
+
+/* called with g_lock held */
+static void
+advance(sp_session *s, uint64_t now)
+{
+    sp_playlistcontainer *pc = &s->pc;
+    sp_playlist **pp;
+    int i;
+
+    /* recomputed below from everything still pending */
+    g_next_due = 0;
+
+    if (s->state == S_LOGGING_IN && now < s->login_at) {
+        schedule(s->login_at);
+    }
+    if (s->state == S_LOGGING_IN && now >= s->login_at && s->login_error) {
+        s->state = S_IDLE;
+        push_event(EV_LOGGED_IN, NULL)->n = s->login_error;
+    }
+    if (s->state == S_LOGGING_IN && now >= s->login_at) {
+        s->state = S_LOGGED_IN;
+        pc->ready_at = now + latency(0, 0) + (cache_is_warm(s) ? 0 : cfg.sync_ms);
+        schedule(pc->ready_at);
+        push_event(EV_LOGGED_IN, NULL);
+        push_event(EV_CREDENTIALS, NULL);
+    }
+
+    if (s->state == S_LOGGED_IN && !pc->loaded && pc->ready_at && now < pc->ready_at) {
+        schedule(pc->ready_at);
+    }
+    if (s->state == S_LOGGED_IN && !pc->loaded && pc->ready_at && now >= pc->ready_at) {
+        for (i = 0; i < pc->num; i++) {
+            if (pc->playlists[i].preloaded && !pc->playlists[i].fail) {
+                __atomic_store_n(&pc->playlists[i].loaded, 1, __ATOMIC_RELEASE);
+            }
+        }
+        __atomic_store_n(&pc->loaded, 1, __ATOMIC_RELEASE);
+        push_event(EV_CONTAINER_LOADED, NULL);
+        cache_rootlist(s);
+    }
+
+    if (cfg.live_edits > 0 && s->state == S_LOGGED_IN && pc->loaded) {
+        uint64_t gap = 1000 / cfg.live_edits;
+
+        if (g_next_edit == 0) {
+            g_next_edit = now + gap;
+        }
+        while (g_next_edit <= now) {
+            live_edit(pc, now);
+            g_next_edit += gap ? gap : 1;
+        }
+        schedule(g_next_edit);
+    }
+
+    pp = &g_active;
+    while (*pp) {
+        sp_playlist *pl = *pp;
+        int loaded = __atomic_load_n(&pl->loaded, __ATOMIC_RELAXED);
+
+        if (!loaded && pl->ready_at && now >= pl->ready_at) {
+            __atomic_store_n(&pl->loaded, 1, __ATOMIC_RELEASE);
+            loaded = 1;
+        }
+        if (loaded && pl->announce) {
+            pl->announce = 0;
+            request_tracks(pl, now);
+            push_event(EV_STATE_CHANGED, pl);
+        } else if (loaded && pl->next_event <= now) {
+            if (resolve_tracks(pl, now)) {
+                push_event(EV_METADATA_UPDATED, pl);
+            }
+        }
+
+        /* drop playlists with nothing left to happen, or nobody listening */
+        if ((loaded && !pl->announce && pl->next_event == NEVER) || pl->ncbs == 0 ||
+            (!loaded && pl->ready_at == 0)) {
+            pl->in_active = 0;
+            *pp = pl->next_active;
+            g_num_active--;
+        } else {
+            schedule(loaded ? pl->next_event : pl->ready_at);
+            pp = &pl->next_active;
+        }
+    }
+}
+
+static int
+still_registered(sp_playlist *pl, sp_playlist_callbacks *cb, void *userdata)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < pl->ncbs; i++) {
+        if (pl->cbs[i].cb == cb && pl->cbs[i].userdata == userdata) {
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return found;
+}
+
+static void
+dispatch(sp_session *s, struct event *ev)
+{
+    const sp_session_callbacks *scb = s->config.callbacks;
+    struct pl_callback cbs[MAX_CALLBACKS];
+    int i, n;
+
+    __atomic_add_fetch(&g_callbacks_fired, 1, __ATOMIC_RELAXED);
+
+    switch (ev->kind) {
+    case EV_LOGGED_IN:
+        if (scb && scb->logged_in) {
+            scb->logged_in(s, ev->n);
+        }
+        return;
+    case EV_CREDENTIALS:
+        if (scb && scb->credentials_blob_updated) {
+            char blob[64];
+            scb->credentials_blob_updated(s, make_blob(s->username, blob, sizeof(blob)));
+        }
+        return;
+    case EV_CONTAINER_LOADED:
+        if (s->pc.cb && s->pc.cb->container_loaded) {
+            s->pc.cb->container_loaded(&s->pc, s->pc.userdata);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    n = ev->pl->ncbs;
+    memcpy(cbs, ev->pl->cbs, n * sizeof(cbs[0]));
+    pthread_mutex_unlock(&g_lock);
+
+    for (i = 0; i < n; i++) {
+        /* an earlier callback may have unregistered this one */
+        if (!still_registered(ev->pl, cbs[i].cb, cbs[i].userdata)) {
+            continue;
+        }
+        if (ev->kind == EV_STATE_CHANGED && cbs[i].cb->playlist_state_changed) {
+            cbs[i].cb->playlist_state_changed(ev->pl, cbs[i].userdata);
+        } else if (ev->kind == EV_METADATA_UPDATED && cbs[i].cb->playlist_metadata_updated) {
+            cbs[i].cb->playlist_metadata_updated(ev->pl, cbs[i].userdata);
+        } else if (ev->kind == EV_TRACKS_ADDED && cbs[i].cb->tracks_added) {
+            cbs[i].cb->tracks_added(ev->pl, ev->tracks, ev->n, ev->position, cbs[i].userdata);
+        } else if (ev->kind == EV_TRACKS_REMOVED && cbs[i].cb->tracks_removed) {
+            cbs[i].cb->tracks_removed(ev->pl, ev->indices, ev->n, cbs[i].userdata);
+        } else if (ev->kind == EV_TRACKS_MOVED && cbs[i].cb->tracks_moved) {
+            cbs[i].cb->tracks_moved(ev->pl, ev->indices, ev->n, ev->position, cbs[i].userdata);
+        }
+    }
+}
+
+/* --- Error handling --- */
+
+const char *
+sp_error_message(sp_error error)
+{
+    switch (error) {
+    case SP_ERROR_OK: return "No error";
+    case SP_ERROR_BAD_API_VERSION: return "Invalid API version";
+    case SP_ERROR_INVALID_INDATA: return "Invalid input";
+    case SP_ERROR_INDEX_OUT_OF_RANGE: return "Index out of range";
+    case SP_ERROR_BAD_USERNAME_OR_PASSWORD: return "Invalid username or password";
+    case SP_ERROR_IS_LOADING: return "Resource not loaded yet";
+    case SP_ERROR_OTHER_PERMANENT: return "Unknown error (permanent)";
+    default: return "Unknown error";
+    }
+}
+
+/* --- Session --- */
+
+sp_error
+sp_session_create(const sp_session_config *config, sp_session **sess)
+{
+    sp_session *s;
+
+    if (config->api_version != SPOTIFY_API_VERSION) {
+        return SP_ERROR_BAD_API_VERSION;
+    }
+    if (g_session) {
+        return SP_ERROR_API_INITIALIZATION_FAILED;
+    }
+
+    g_start = now_ms();
+    read_config();
+
+    s = calloc(1, sizeof(*s));
+    s->config = *config;
+    s->pc.refs = 1;
+    build_catalogue(&s->pc);
+    g_session = s;
+
+    if (cfg.report) {
+        atexit(report);
+    }
+    pthread_create(&g_net_thread, NULL, net_thread, NULL);
+
+    *sess = s;
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_session_release(sp_session *sess)
+{
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_session_login(sp_session *session, const char *username, const char *password,
+                 bool remember_me, const char *blob)
+{
+    char expect[64];
+
+    if (username == NULL || (password == NULL && blob == NULL)) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+    pthread_mutex_lock(&g_lock);
+    snprintf(session->username, sizeof(session->username), "%s", username);
+    session->login_error = password == NULL &&
+        strcmp(blob, make_blob(username, expect, sizeof(expect))) != 0 ?
+        SP_ERROR_BAD_USERNAME_OR_PASSWORD : SP_ERROR_OK;
+    session->state = S_LOGGING_IN;
+    session->login_at = now_ms() + latency(0, 1) + (password ? cfg.auth_ms : 0);
+    schedule(session->login_at);
+    pthread_mutex_unlock(&g_lock);
+    notify();
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_session_logout(sp_session *session)
+{
+    pthread_mutex_lock(&g_lock);
+    session->state = S_LOGGED_OUT;
+    pthread_mutex_unlock(&g_lock);
+    return SP_ERROR_OK;
+}
+
+sp_connectionstate
+sp_session_connectionstate(sp_session *session)
+{
+    return session->state == S_LOGGED_IN ?
+        SP_CONNECTION_STATE_LOGGED_IN : SP_CONNECTION_STATE_LOGGED_OUT;
+}
+
+void *
+sp_session_userdata(sp_session *session)
+{
+    return session->config.userdata;
+}
+
+sp_error
+sp_session_process_events(sp_session *session, int *next_timeout)
+{
+    uint64_t now = now_ms(), due;
+    struct event *evs;
+    int i, n;
+
+    __atomic_add_fetch(&g_events_processed, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_lock);
+    advance(session, now);
+    n = g_nevents;
+    evs = malloc((n ? n : 1) * sizeof(*evs));
+    memcpy(evs, g_events, n * sizeof(*evs));
+    g_nevents = 0;
+    due = g_next_due;
+    pthread_mutex_unlock(&g_lock);
+
+    for (i = 0; i < n; i++) {
+        dispatch(session, &evs[i]);
+    }
+    free(evs);
+
+    now = now_ms();
+    *next_timeout = due == 0 ? 1000 : due <= now ? 1 : due - now > 1000 ? 1000 : (int)(due - now);
+    return SP_ERROR_OK;
+}
+
+sp_playlistcontainer *
+sp_session_playlistcontainer(sp_session *session)
+{
+    return session->state == S_LOGGED_IN ? &session->pc : NULL;
+}
+
+/* --- Links --- */
+
+static const char base62[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/* 22 character base62 id, derived from the object kind and index */
+static void
+spotify_id(char *out, int kind, int id)
+{
+    uint64_t h = mix(((uint64_t)kind << 40) ^ (uint64_t)id);
+    uint64_t l = mix(h);
+    int i;
+
+    for (i = 0; i < 11; i++) {
+        out[i] = base62[h % 62];
+        h /= 62;
+        out[11 + i] = base62[l % 62];
+        l /= 62;
+    }
+    out[22] = '\0';
+}
+
+static sp_link *
+link_new(sp_linktype type, void *obj)
+{
+    sp_link *l;
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    l = malloc(sizeof(*l));
+    l->type = type;
+    l->obj = obj;
+    l->refs = 1;
+    __atomic_add_fetch(&g_links_created, 1, __ATOMIC_RELAXED);
+    return l;
+}
+
+sp_link *
+sp_link_create_from_track(sp_track *track, int offset)
+{
+    return link_new(SP_LINKTYPE_TRACK, track);
+}
+
+sp_link *
+sp_link_create_from_album(sp_album *album)
+{
+    return link_new(SP_LINKTYPE_ALBUM, album);
+}
+
+sp_link *
+sp_link_create_from_artist(sp_artist *artist)
+{
+    return link_new(SP_LINKTYPE_ARTIST, artist);
+}
+
+sp_link *
+sp_link_create_from_playlist(sp_playlist *playlist)
+{
+    if (!sp_playlist_is_loaded(playlist)) {
+        return NULL;
+    }
+    return link_new(SP_LINKTYPE_PLAYLIST, playlist);
+}
+
+/* playlist URIs only, which is all px parses */
+sp_link *
+sp_link_create_from_string(const char *link)
+{
+    const char *id = strstr(link, ":playlist:");
+    char want[23];
+    int i;
+
+    if (g_session == NULL || strncmp(link, "spotify:user:", 13) != 0 || id == NULL) {
+        return NULL;
+    }
+    id += strlen(":playlist:");
+    for (i = 0; i < g_session->pc.num; i++) {
+        spotify_id(want, SP_LINKTYPE_PLAYLIST, i);
+        if (strcmp(id, want) == 0) {
+            sp_playlist *pl = &g_session->pc.playlists[i];
+            if (strncmp(link + 13, pl->owner->name, strlen(pl->owner->name)) != 0 ||
+                link[13 + strlen(pl->owner->name)] != ':') {
+                return NULL;
+            }
+            return link_new(SP_LINKTYPE_PLAYLIST, pl);
+        }
+    }
+    return NULL;
+}
+
+int
+sp_link_as_string(sp_link *link, char *buffer, int buffer_size)
+{
+    char id[23];
+
+    switch (link->type) {
+    case SP_LINKTYPE_TRACK:
+        spotify_id(id, SP_LINKTYPE_TRACK, ((sp_track *)link->obj)->id);
+        return snprintf(buffer, buffer_size, "spotify:track:%s", id);
+    case SP_LINKTYPE_ALBUM:
+        spotify_id(id, SP_LINKTYPE_ALBUM, ((sp_album *)link->obj)->id);
+        return snprintf(buffer, buffer_size, "spotify:album:%s", id);
+    case SP_LINKTYPE_ARTIST:
+        spotify_id(id, SP_LINKTYPE_ARTIST, ((sp_artist *)link->obj)->id);
+        return snprintf(buffer, buffer_size, "spotify:artist:%s", id);
+    case SP_LINKTYPE_PLAYLIST: {
+        sp_playlist *pl = link->obj;
+        spotify_id(id, SP_LINKTYPE_PLAYLIST, pl->id);
+        return snprintf(buffer, buffer_size, "spotify:user:%s:playlist:%s", pl->owner->name, id);
+    }
+    default:
+        if (buffer_size > 0) {
+            buffer[0] = '\0';
+        }
+        return 0;
+    }
+}
+
+sp_linktype
+sp_link_type(sp_link *link)
+{
+    return link->type;
+}
+
+sp_error
+sp_link_add_ref(sp_link *link)
+{
+    __atomic_add_fetch(&link->refs, 1, __ATOMIC_RELAXED);
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_link_release(sp_link *link)
+{
+    if (link && __atomic_sub_fetch(&link->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(link);
+    }
+    return SP_ERROR_OK;
+}
+
+/* --- Tracks, albums, artists, users --- */
+
+bool
+sp_track_is_loaded(sp_track *track)
+{
+    return track && __atomic_load_n(&track->loaded, __ATOMIC_ACQUIRE);
+}
+
+sp_error
+sp_track_error(sp_track *track)
+{
+    if (track == NULL) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+    return sp_track_is_loaded(track) ? SP_ERROR_OK : SP_ERROR_IS_LOADING;
+}
+
+int
+sp_track_num_artists(sp_track *track)
+{
+    return sp_track_is_loaded(track) ? track->num_artists : 0;
+}
+
+sp_artist *
+sp_track_artist(sp_track *track, int index)
+{
+    if (!sp_track_is_loaded(track) || index < 0 || index >= track->num_artists) {
+        return NULL;
+    }
+    return track->artists[index];
+}
+
+sp_album *
+sp_track_album(sp_track *track)
+{
+    return sp_track_is_loaded(track) ? track->album : NULL;
+}
+
+const char *
+sp_track_name(sp_track *track)
+{
+    return sp_track_is_loaded(track) ? track->name : "";
+}
+
+int
+sp_track_duration(sp_track *track)
+{
+    return sp_track_is_loaded(track) ? track->duration : 0;
+}
+
+sp_error
+sp_track_add_ref(sp_track *track)
+{
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_track_release(sp_track *track)
+{
+    return SP_ERROR_OK;
+}
+
+bool
+sp_album_is_loaded(sp_album *album)
+{
+    return album != NULL;
+}
+
+const char *
+sp_album_name(sp_album *album)
+{
+    return album ? album->name : "";
+}
+
+sp_error
+sp_album_add_ref(sp_album *album)
+{
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_album_release(sp_album *album)
+{
+    return SP_ERROR_OK;
+}
+
+const char *
+sp_artist_name(sp_artist *artist)
+{
+    return artist ? artist->name : "";
+}
+
+bool
+sp_artist_is_loaded(sp_artist *artist)
+{
+    return artist != NULL;
+}
+
+sp_error
+sp_artist_add_ref(sp_artist *artist)
+{
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_artist_release(sp_artist *artist)
+{
+    return SP_ERROR_OK;
+}
+
+const char *
+sp_user_canonical_name(sp_user *user)
+{
+    return user->name;
+}
+
+const char *
+sp_user_display_name(sp_user *user)
+{
+    return user->name;
+}
+
+bool
+sp_user_is_loaded(sp_user *user)
+{
+    return user != NULL;
+}
+
+/* --- Playlists --- */
+
+bool
+sp_playlist_is_loaded(sp_playlist *playlist)
+{
+    return playlist && __atomic_load_n(&playlist->loaded, __ATOMIC_ACQUIRE);
+}
+
+sp_error
+sp_playlist_add_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata)
+{
+    if (playlist == NULL || callbacks == NULL) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (playlist->ncbs == MAX_CALLBACKS) {
+        pthread_mutex_unlock(&g_lock);
+        return SP_ERROR_OTHER_TRANSIENT;
+    }
+    playlist->cbs[playlist->ncbs].cb = callbacks;
+    playlist->cbs[playlist->ncbs].userdata = userdata;
+    playlist->ncbs++;
+
+    /* subscribing is what makes libspotify fetch the playlist */
+    if (!__atomic_load_n(&playlist->loaded, __ATOMIC_RELAXED)) {
+        if (playlist->ready_at == 0 && !playlist->fail) {
+            playlist->ready_at = now_ms() + load_latency(2, playlist->id);
+            schedule(playlist->ready_at);
+        }
+        playlist->announce = 1;
+    } else if (callbacks->playlist_state_changed) {
+        playlist->announce = 1;
+        schedule(now_ms());
+    }
+    if (playlist->announce || playlist->next_event != NEVER) {
+        activate(playlist);
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    notify();
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_playlist_remove_callbacks(sp_playlist *playlist, sp_playlist_callbacks *callbacks, void *userdata)
+{
+    int i;
+
+    if (playlist == NULL) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < playlist->ncbs; i++) {
+        if (playlist->cbs[i].cb == callbacks && playlist->cbs[i].userdata == userdata) {
+            memmove(&playlist->cbs[i], &playlist->cbs[i + 1],
+                    (playlist->ncbs - i - 1) * sizeof(playlist->cbs[0]));
+            playlist->ncbs--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return SP_ERROR_OK;
+}
+
+int
+sp_playlist_num_tracks(sp_playlist *playlist)
+{
+    return sp_playlist_is_loaded(playlist) ? playlist->num_tracks : 0;
+}
+
+sp_track *
+sp_playlist_track(sp_playlist *playlist, int index)
+{
+    if (!sp_playlist_is_loaded(playlist) || index < 0 || index >= playlist->num_tracks) {
+        return NULL;
+    }
+    return &g_tracks[playlist->entries[index].track];
+}
+
+int
+sp_playlist_track_create_time(sp_playlist *playlist, int index)
+{
+    if (!sp_playlist_is_loaded(playlist) || index < 0 || index >= playlist->num_tracks) {
+        return 0;
+    }
+    return playlist->entries[index].when;
+}
+
+sp_user *
+sp_playlist_track_creator(sp_playlist *playlist, int index)
+{
+    if (!sp_playlist_is_loaded(playlist) || index < 0 || index >= playlist->num_tracks) {
+        return NULL;
+    }
+    return &g_users[playlist->entries[index].creator];
+}
+
+const char *
+sp_playlist_name(sp_playlist *playlist)
+{
+    return sp_playlist_is_loaded(playlist) ? playlist->name : "";
+}
+
+sp_user *
+sp_playlist_owner(sp_playlist *playlist)
+{
+    return sp_playlist_is_loaded(playlist) ? playlist->owner : NULL;
+}
+
+const char *
+sp_playlist_get_description(sp_playlist *playlist)
+{
+    return sp_playlist_is_loaded(playlist) ? playlist->description : NULL;
+}
+
+/* the playlist is loaded once someone subscribes to it, as from the rootlist */
+sp_playlist *
+sp_playlist_create(sp_session *session, sp_link *link)
+{
+    if (link == NULL || link->type != SP_LINKTYPE_PLAYLIST) {
+        return NULL;
+    }
+    sp_playlist_add_ref(link->obj);
+    return link->obj;
+}
+
+sp_error
+sp_playlist_add_ref(sp_playlist *playlist)
+{
+    if (playlist == NULL) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+    __atomic_add_fetch(&playlist->refs, 1, __ATOMIC_RELAXED);
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_playlist_release(sp_playlist *playlist)
+{
+    if (playlist == NULL) {
+        return SP_ERROR_INVALID_INDATA;
+    }
+    __atomic_sub_fetch(&playlist->refs, 1, __ATOMIC_RELAXED);
+    return SP_ERROR_OK;
+}
+
+/* --- Playlist container --- */
+
+sp_error
+sp_playlistcontainer_add_callbacks(sp_playlistcontainer *pc,
+                                   sp_playlistcontainer_callbacks *callbacks, void *userdata)
+{
+    pthread_mutex_lock(&g_lock);
+    pc->cb = callbacks;
+    pc->userdata = userdata;
+    pthread_mutex_unlock(&g_lock);
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_playlistcontainer_remove_callbacks(sp_playlistcontainer *pc,
+                                      sp_playlistcontainer_callbacks *callbacks, void *userdata)
+{
+    pthread_mutex_lock(&g_lock);
+    if (pc->cb == callbacks && pc->userdata == userdata) {
+        pc->cb = NULL;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return SP_ERROR_OK;
+}
+
+int
+sp_playlistcontainer_num_playlists(sp_playlistcontainer *pc)
+{
+    return sp_playlistcontainer_is_loaded(pc) ? pc->num : 0;
+}
+
+bool
+sp_playlistcontainer_is_loaded(sp_playlistcontainer *pc)
+{
+    return pc && __atomic_load_n(&pc->loaded, __ATOMIC_ACQUIRE);
+}
+
+sp_playlist *
+sp_playlistcontainer_playlist(sp_playlistcontainer *pc, int index)
+{
+    if (!sp_playlistcontainer_is_loaded(pc) || index < 0 || index >= pc->num) {
+        return NULL;
+    }
+    return &pc->playlists[index];
+}
+
+sp_playlist_type
+sp_playlistcontainer_playlist_type(sp_playlistcontainer *pc, int index)
+{
+    return SP_PLAYLIST_TYPE_PLAYLIST;
+}
+
+sp_error
+sp_playlistcontainer_add_ref(sp_playlistcontainer *pc)
+{
+    __atomic_add_fetch(&pc->refs, 1, __ATOMIC_RELAXED);
+    return SP_ERROR_OK;
+}
+
+sp_error
+sp_playlistcontainer_release(sp_playlistcontainer *pc)
+{
+    __atomic_sub_fetch(&pc->refs, 1, __ATOMIC_RELAXED);
+    return SP_ERROR_OK;
+}
@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libspotify/api.h>
+
+#include "link-cache.h"
+
+/*
+ * Run-wide cache of album and artist URIs and names, keyed by handle.
+ *
+ * The same albums and artists turn up thousands of times across a
+ * container, so each one is turned into a link and formatted once.  We
+ * hold a reference on every cached handle so libspotify cannot recycle
+ * the pointer for a different object.  Nothing is evicted; strings live
+ * in an append-only arena for the rest of the run.
+ */
+
+enum { ALBUM, ARTIST, KINDS };
+
+struct link_table {
+    struct link_entry *slots;
+    size_t used;
+    size_t cap;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+static struct link_table g_tables[KINDS];
+static pthread_mutex_t g_link_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* --- string arena --- */
+#define ARENA_CHUNK 65536
+
+static char *arena_cur;
+static size_t arena_left;
+
+static const char *
+arena_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *r;
+
+    if (len > arena_left) {
+        size_t sz = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+        arena_cur = malloc(sz);
+        if (arena_cur == NULL) {
+            fprintf(stderr, "link-cache: out of memory\n");
+            exit(1);
+        }
+        arena_left = sz;
+    }
+    r = arena_cur;
+    memcpy(r, s, len);
+    arena_cur += len;
+    arena_left -= len;
+    return r;
+}
+
+static size_t
+hash_ptr(const void *p)
+{
+    uintptr_t x = (uintptr_t)p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static struct link_entry *
+lookup(struct link_table *t, const void *key)
+{
+    size_t i, mask;
+
+    if (2 * (t->used + 1) > t->cap) {
+        struct link_entry *old = t->slots;
+        size_t old_cap = t->cap;
+
+        t->cap = old_cap ? 2 * old_cap : 1024;
+        t->slots = calloc(t->cap, sizeof(*t->slots));
+        if (t->slots == NULL) {
+            fprintf(stderr, "link-cache: out of memory\n");
+            exit(1);
+        }
+        mask = t->cap - 1;
+        for (i = 0; i < old_cap; i++) {
+            if (old[i].key) {
+                size_t j = hash_ptr(old[i].key) & mask;
+                while (t->slots[j].key) {
+                    j = (j + 1) & mask;
+                }
+                t->slots[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    mask = t->cap - 1;
+    for (i = hash_ptr(key) & mask; t->slots[i].key; i = (i + 1) & mask) {
+        if (t->slots[i].key == key) {
+            break;
+        }
+    }
+    return &t->slots[i];
+}
+
+/*
+ * Format a freshly created link and cache it.  Objects that are not loaded
+ * yet are formatted into a per-thread scratch entry but not cached, since
+ * their name is still empty.
+ */
+static const struct link_entry *
+intern(int kind, const void *key, sp_link *link, const char *name, int loaded)
+{
+    static __thread struct link_entry scratch;
+    static __thread char scratch_uri[1024];
+    struct link_entry *e;
+    char uri[1024];
+
+    if (link == NULL) {
+        return NULL;
+    }
+    sp_link_as_string(link, uri, sizeof(uri));
+    sp_link_release(link);
+
+    if (!loaded) {
+        memcpy(scratch_uri, uri, sizeof(uri));
+        scratch.key = key;
+        scratch.uri = scratch_uri;
+        scratch.name = name;
+        return &scratch;
+    }
+
+    pthread_mutex_lock(&g_link_mutex);
+    e = lookup(&g_tables[kind], key);
+    if (e->key == NULL) {
+        e->key = key;
+        e->uri = arena_strdup(uri);
+        e->name = arena_strdup(name);
+        g_tables[kind].used++;
+        if (kind == ALBUM) {
+            sp_album_add_ref((sp_album *)key);
+        } else {
+            sp_artist_add_ref((sp_artist *)key);
+        }
+    }
+    pthread_mutex_unlock(&g_link_mutex);
+    return e;
+}
+
+static const struct link_entry *
+cached(int kind, const void *key)
+{
+    struct link_entry *e;
+
+    pthread_mutex_lock(&g_link_mutex);
+    e = lookup(&g_tables[kind], key);
+    if (e->key) {
+        g_tables[kind].hits++;
+    } else {
+        g_tables[kind].misses++;
+        e = NULL;
+    }
+    pthread_mutex_unlock(&g_link_mutex);
+    return e;
+}
+
+const struct link_entry *
+album_link(sp_album *album)
+{
+    const struct link_entry *e;
+
+    if (album == NULL) {
+        return NULL;
+    }
+    if ((e = cached(ALBUM, album)) != NULL) {
+        return e;
+    }
+    return intern(ALBUM, album, sp_link_create_from_album(album),
+                  sp_album_name(album), sp_album_is_loaded(album));
+}
+
+const struct link_entry *
+artist_link(sp_artist *artist)
+{
+    const struct link_entry *e;
+
+    if (artist == NULL) {
+        return NULL;
+    }
+    if ((e = cached(ARTIST, artist)) != NULL) {
+        return e;
+    }
+    return intern(ARTIST, artist, sp_link_create_from_artist(artist),
+                  sp_artist_name(artist), sp_artist_is_loaded(artist));
+}
+
+void
+link_cache_stats(unsigned long *hits, unsigned long *misses)
+{
+    int k;
+
+    *hits = *misses = 0;
+    pthread_mutex_lock(&g_link_mutex);
+    for (k = 0; k < KINDS; k++) {
+        *hits += g_tables[k].hits;
+        *misses += g_tables[k].misses;
+    }
+    pthread_mutex_unlock(&g_link_mutex);
+}
+
+/* every miss created a link */
+void
+link_cache_created(unsigned long *albums, unsigned long *artists)
+{
+    pthread_mutex_lock(&g_link_mutex);
+    *albums = g_tables[ALBUM].misses;
+    *artists = g_tables[ARTIST].misses;
+    pthread_mutex_unlock(&g_link_mutex);
+}
+
+void
+print_link_cache_stats(void)
+{
+    pthread_mutex_lock(&g_link_mutex);
+    fprintf(stderr, "LC album hits=%lu misses=%lu cached=%zu\n",
+            g_tables[ALBUM].hits, g_tables[ALBUM].misses, g_tables[ALBUM].used);
+    fprintf(stderr, "LC artist hits=%lu misses=%lu cached=%zu\n",
+            g_tables[ARTIST].hits, g_tables[ARTIST].misses, g_tables[ARTIST].used);
+    pthread_mutex_unlock(&g_link_mutex);
+}
@@ -0,0 +1,15 @@
+struct link_entry {
+    const void *key;  /* sp_album* or sp_artist* */
+    const char *uri;
+    const char *name;
+};
+
+/* an entry is only valid until the next call, which may move it, but the
+ * uri and name it points to stay valid for the whole run, except for
+ * objects that were not loaded yet, whose strings are only valid until the
+ * next call on the same thread */
+const struct link_entry *album_link(sp_album *);
+const struct link_entry *artist_link(sp_artist *);
+void link_cache_stats(unsigned long *hits, unsigned long *misses);
+void link_cache_created(unsigned long *albums, unsigned long *artists);
+void print_link_cache_stats(void);
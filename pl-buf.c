@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pl-buf.h"
+
+static void
+buf_reserve(struct pl_buf *b, size_t extra)
+{
+    size_t n;
+
+    if (b->len + extra <= b->cap) {
+        return;
+    }
+    n = b->cap ? b->cap : 4096;
+    while (n < b->len + extra) {
+        n *= 2;
+    }
+    b->data = realloc(b->data, n);
+    if (b->data == NULL) {
+        fprintf(stderr, "pl-buf: out of memory (%zu bytes)\n", n);
+        exit(1);
+    }
+    b->cap = n;
+}
+
+void
+buf_init(struct pl_buf *b, size_t size)
+{
+    b->data = NULL;
+    b->len = b->cap = 0;
+    buf_reserve(b, size);
+}
+
+void
+buf_free(struct pl_buf *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+void
+buf_append(struct pl_buf *b, const void *p, size_t len)
+{
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, p, len);
+    b->len += len;
+}
+
+void
+buf_printf(struct pl_buf *b, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+
+    if (n >= 0 && (size_t)n >= b->cap - b->len) {
+        buf_reserve(b, n + 1);
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    if (n > 0) {
+        b->len += n;
+    }
+}
+
+/* write out the whole buffer, keeping it; returns 0 or -1 with errno set */
+int
+buf_write(const struct pl_buf *b, int fd)
+{
+    size_t off = 0;
+
+    while (off < b->len) {
+        ssize_t w = write(fd, b->data + off, b->len - off);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        off += w;
+    }
+    return 0;
+}
+
+/* write out and empty the buffer */
+int
+buf_flush(struct pl_buf *b, int fd)
+{
+    if (buf_write(b, fd) != 0) {
+        return -1;
+    }
+    b->len = 0;
+    return 0;
+}
+
+/* "65536", "64k", "4M" into *n; returns -1 for anything else */
+int
+parse_size(const char *s, size_t *n)
+{
+    char *end;
+    unsigned long long v;
+    int shift = 0;
+
+    if (*s < '0' || *s > '9') {
+        return -1;
+    }
+    errno = 0;
+    v = strtoull(s, &end, 10);
+    if (errno == ERANGE) {
+        return -1;
+    }
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || v > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *n = (size_t)v << shift;
+    return 0;
+}
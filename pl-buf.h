@@ -0,0 +1,15 @@
+/* growable output buffer, reused from one playlist to the next */
+struct pl_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+void buf_init(struct pl_buf *, size_t);
+void buf_free(struct pl_buf *);
+void buf_append(struct pl_buf *, const void *, size_t);
+void buf_printf(struct pl_buf *, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+int buf_write(const struct pl_buf *, int);
+int buf_flush(struct pl_buf *, int);
+int parse_size(const char *, size_t *);
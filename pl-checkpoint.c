@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pl-buf.h"
+#include "pl-checkpoint.h"
+
+/*
+ * Checkpoint of playlists that have been written out completely.
+ *
+ * The file is a log of playlist URIs, one per line, appended as each
+ * playlist's PLAYLIST:END leaves the writer.  Lines are collected and
+ * written CHECKPOINT_BATCH at a time (or every CHECKPOINT_SECS, whichever
+ * comes first) with a single write, after the output
+ * itself has been synced, and then the log is synced.  All of this runs
+ * on the writer thread, which also calls checkpoint_tick() while idle to
+ * write out a batch once it is CHECKPOINT_SECS old even if nothing more is
+ * written, so syncing never holds up libspotify.  So a URI in the log
+ * always means its playlist is safely in the output, and a crash costs at
+ * most one batch.  A line torn by a crash has no newline; on resume it is
+ * ignored and cut off before anything more is appended.
+ *
+ * Without --resume the log is started afresh by renaming an empty file
+ * over it, so an old checkpoint never applies to a new dump.
+ */
+
+#define CHECKPOINT_BATCH 64
+#define CHECKPOINT_SECS 5
+
+static int g_fd = -1;
+static int g_out_fd = -1;
+static struct pl_buf g_batch;
+static int g_batched;
+static time_t g_batch_started;
+
+/* URIs done in the run being resumed */
+static char **g_done;
+static size_t g_done_cap, g_done_used;
+
+static uint32_t
+hash(const char *s)
+{
+    uint32_t h = 2166136261U;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619U;
+    }
+    return h;
+}
+
+static void
+done_insert(const char *uri)
+{
+    size_t i;
+
+    if (2 * (g_done_used + 1) > g_done_cap) {
+        char **old = g_done;
+        size_t old_cap = g_done_cap;
+
+        g_done_cap = old_cap ? 2 * old_cap : 1024;
+        g_done = calloc(g_done_cap, sizeof(*g_done));
+        if (g_done == NULL) {
+            fprintf(stderr, "pl-checkpoint: out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < old_cap; i++) {
+            if (old[i]) {
+                size_t j = hash(old[i]) & (g_done_cap - 1);
+                while (g_done[j]) {
+                    j = (j + 1) & (g_done_cap - 1);
+                }
+                g_done[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    for (i = hash(uri) & (g_done_cap - 1); g_done[i]; i = (i + 1) & (g_done_cap - 1)) {
+        if (strcmp(g_done[i], uri) == 0) {
+            return;
+        }
+    }
+    g_done[i] = strdup(uri);
+    if (g_done[i] == NULL) {
+        fprintf(stderr, "pl-checkpoint: out of memory\n");
+        exit(1);
+    }
+    g_done_used++;
+}
+
+int
+checkpoint_done(const char *uri)
+{
+    size_t i;
+
+    if (g_done_used == 0) {
+        return 0;
+    }
+    for (i = hash(uri) & (g_done_cap - 1); g_done[i]; i = (i + 1) & (g_done_cap - 1)) {
+        if (strcmp(g_done[i], uri) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* whether this run resumes one that had already written some playlists */
+int
+checkpoint_resuming(void)
+{
+    return g_done_used > 0;
+}
+
+static int
+load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    off_t end = 0, good = 0;    /* of what was read, and of its last full line */
+
+    if (fp == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    while ((len = getline(&line, &cap, fp)) != -1) {
+        end += len;
+        if (line[len - 1] == '\n') {
+            good = end;
+        }
+        if (len > 1 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+            done_insert(line);
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    /* cut off a line torn by the crash, so appending starts a fresh one */
+    if (end > good) {
+        fprintf(stderr, "CP dropping %lld bytes of a torn line\n", (long long)(end - good));
+        if (truncate(path, good) != 0) {
+            return -1;
+        }
+    }
+    fprintf(stderr, "CP resuming, %zu playlists already done\n", g_done_used);
+    return 0;
+}
+
+/* replace path with an empty file */
+static int
+truncate_atomically(const char *path)
+{
+    char tmp[1024];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fsync(fd) != 0 || close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Start checkpointing to path.  With resume, the URIs already in it are
+ * loaded for checkpoint_done() and new ones are appended; otherwise it is
+ * emptied first.  out_fd is synced before each batch is recorded.
+ */
+int
+checkpoint_open(const char *path, int resume, int out_fd)
+{
+    if (resume ? load(path) != 0 : truncate_atomically(path) != 0) {
+        fprintf(stderr, "checkpoint %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    g_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (g_fd < 0) {
+        fprintf(stderr, "checkpoint %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    g_out_fd = out_fd;
+    buf_init(&g_batch, 4096);
+    return 0;
+}
+
+static void
+flush_batch(void)
+{
+    if (g_batched == 0) {
+        return;
+    }
+    /* pipes and terminals can't be synced, and don't need to be */
+    if (fsync(g_out_fd) != 0 && errno != EINVAL && errno != EROFS) {
+        fprintf(stderr, "checkpoint: sync output: %s\n", strerror(errno));
+        return;
+    }
+    if (buf_flush(&g_batch, g_fd) != 0 || fdatasync(g_fd) != 0) {
+        fprintf(stderr, "checkpoint: %s\n", strerror(errno));
+    }
+    g_batch.len = 0;
+    g_batched = 0;
+}
+
+/* record a playlist whose output has been written; called by the writer */
+void
+checkpoint_add(const char *uri)
+{
+    if (g_fd < 0) {
+        return;
+    }
+    buf_printf(&g_batch, "%s\n", uri);
+    if (g_batched++ == 0) {
+        g_batch_started = time(NULL);
+    }
+    if (g_batched >= CHECKPOINT_BATCH || time(NULL) - g_batch_started >= CHECKPOINT_SECS) {
+        flush_batch();
+    }
+}
+
+/* how long the writer may idle before checkpoint_tick has work to do */
+int
+checkpoint_wait_ms(void)
+{
+    int ms = -1;
+
+    if (g_fd < 0) {
+        return -1;
+    }
+    if (g_batched > 0) {
+        ms = (g_batch_started + CHECKPOINT_SECS - time(NULL)) * 1000;
+        if (ms < 0) {
+            ms = 0;
+        }
+    }
+    return ms;
+}
+
+/* write out a batch that has waited CHECKPOINT_SECS; called by the idle writer */
+void
+checkpoint_tick(void)
+{
+    if (g_fd < 0) {
+        return;
+    }
+    if (g_batched > 0 && time(NULL) - g_batch_started >= CHECKPOINT_SECS) {
+        flush_batch();
+    }
+}
+
+/* record whatever is batched; call once the writer has finished */
+void
+checkpoint_close(void)
+{
+    if (g_fd < 0) {
+        return;
+    }
+    flush_batch();
+    close(g_fd);
+    g_fd = -1;
+    buf_free(&g_batch);
+}
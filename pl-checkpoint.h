@@ -0,0 +1,7 @@
+int checkpoint_open(const char *path, int resume, int out_fd);
+int checkpoint_done(const char *uri);
+int checkpoint_resuming(void);
+void checkpoint_add(const char *uri);
+int checkpoint_wait_ms(void);
+void checkpoint_tick(void);
+void checkpoint_close(void);
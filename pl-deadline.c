@@ -0,0 +1,306 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "pl-deadline.h"
+
+/*
+ * Deadlines for playlists being fetched.
+ *
+ * Each fetch arms a timer.  If it fires with the playlist still loading,
+ * the playlist gives up its working slot and sits out a backoff that
+ * doubles with every attempt before being fetched again.  Once its
+ * retries are used up the caller writes out whatever has loaded.
+ *
+ * Timers are kept in a binary heap ordered by expiry, so finding the next
+ * one is O(1) and arming one O(log n).  Nothing is ever removed from the
+ * middle of the heap: each playlist's record has a generation that is
+ * bumped whenever its timer is re-armed or cancelled, and stale heap
+ * entries are dropped as they reach the top.  Main thread only.
+ */
+
+struct deadline {
+    sp_playlist *pl;
+    int attempts;           /* deadlines missed so far */
+    unsigned gen;           /* of the timer currently armed */
+    int backing_off;        /* its armed timer is a DL_RETRY */
+    struct deadline *next;
+};
+
+struct timer {
+    double when;
+    sp_playlist *pl;
+    unsigned gen;
+    int kind;
+};
+
+static int g_timeout_ms, g_retries, g_backoff_ms;
+
+static struct deadline **g_buckets;
+static size_t g_nbuckets, g_count;
+
+static struct timer *g_heap;
+static size_t g_heap_len, g_heap_cap;
+
+static unsigned long g_timeouts, g_retried, g_given_up;
+static size_t g_backing_off;
+
+void
+deadline_init(int timeout_ms, int retries, int backoff_ms)
+{
+    g_timeout_ms = timeout_ms;
+    g_retries = retries;
+    g_backoff_ms = backoff_ms;
+}
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static size_t
+bucket(sp_playlist *pl, size_t n)
+{
+    uintptr_t x = (uintptr_t)pl;
+    x ^= x >> 17;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (x >> 20) & (n - 1);
+}
+
+static void
+rehash(void)
+{
+    size_t n = g_nbuckets ? 2 * g_nbuckets : 256, i;
+    struct deadline **b = calloc(n, sizeof(*b));
+
+    if (b == NULL) {
+        fprintf(stderr, "pl-deadline: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < g_nbuckets; i++) {
+        struct deadline *d = g_buckets[i], *next;
+        for (; d; d = next) {
+            size_t k = bucket(d->pl, n);
+            next = d->next;
+            d->next = b[k];
+            b[k] = d;
+        }
+    }
+    free(g_buckets);
+    g_buckets = b;
+    g_nbuckets = n;
+}
+
+static struct deadline *
+find(sp_playlist *pl, int create)
+{
+    struct deadline *d;
+    size_t k;
+
+    if (g_nbuckets) {
+        for (d = g_buckets[bucket(pl, g_nbuckets)]; d; d = d->next) {
+            if (d->pl == pl) {
+                return d;
+            }
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (g_count >= g_nbuckets) {
+        rehash();
+    }
+    d = calloc(1, sizeof(*d));
+    if (d == NULL) {
+        fprintf(stderr, "pl-deadline: out of memory\n");
+        exit(1);
+    }
+    d->pl = pl;
+    k = bucket(pl, g_nbuckets);
+    d->next = g_buckets[k];
+    g_buckets[k] = d;
+    g_count++;
+    return d;
+}
+
+static void
+heap_push(struct timer t)
+{
+    size_t i;
+
+    if (g_heap_len == g_heap_cap) {
+        g_heap_cap = g_heap_cap ? 2 * g_heap_cap : 64;
+        g_heap = realloc(g_heap, g_heap_cap * sizeof(*g_heap));
+        if (g_heap == NULL) {
+            fprintf(stderr, "pl-deadline: out of memory\n");
+            exit(1);
+        }
+    }
+    for (i = g_heap_len++; i > 0 && t.when < g_heap[(i - 1) / 2].when; i = (i - 1) / 2) {
+        g_heap[i] = g_heap[(i - 1) / 2];
+    }
+    g_heap[i] = t;
+}
+
+static void
+heap_pop(void)
+{
+    struct timer last = g_heap[--g_heap_len];
+    size_t i, child;
+
+    for (i = 0; (child = 2 * i + 1) < g_heap_len; i = child) {
+        if (child + 1 < g_heap_len && g_heap[child + 1].when < g_heap[child].when) {
+            child++;
+        }
+        if (!(g_heap[child].when < last.when)) {
+            break;
+        }
+        g_heap[i] = g_heap[child];
+    }
+    g_heap[i] = last;
+}
+
+static void
+set_backing_off(struct deadline *d, int on)
+{
+    g_backing_off += on - d->backing_off;
+    d->backing_off = on;
+}
+
+static void
+arm(struct deadline *d, int kind, double ms)
+{
+    struct timer t = { now_ms() + ms, d->pl, ++d->gen, kind };
+    heap_push(t);
+    set_backing_off(d, kind == DL_RETRY);
+}
+
+/* drop cancelled and superseded timers from the top of the heap */
+static void
+prune(void)
+{
+    while (g_heap_len) {
+        struct deadline *d = find(g_heap[0].pl, 0);
+        if (d && d->gen == g_heap[0].gen) {
+            return;
+        }
+        heap_pop();
+    }
+}
+
+/* the playlist has just been fetched, or fetched again */
+void
+deadline_fetch(sp_playlist *pl)
+{
+    if (g_timeout_ms > 0) {
+        arm(find(pl, 1), DL_TIMEOUT, g_timeout_ms);
+    }
+}
+
+/*
+ * The playlist missed its deadline.  Returns 1 if it has retries left, in
+ * which case DL_RETRY fires after the backoff, or 0 if it should be given
+ * up on.
+ */
+int
+deadline_retry(sp_playlist *pl)
+{
+    struct deadline *d = find(pl, 1);
+    double backoff;
+
+    g_timeouts++;
+    if (d->attempts >= g_retries) {
+        g_given_up++;
+        return 0;
+    }
+    backoff = (double)g_backoff_ms * (1 << (d->attempts < 16 ? d->attempts : 16));
+    d->attempts++;
+    g_retried++;
+    fprintf(stderr, "DL retry %d/%d in %.1fs %s\n", d->attempts, g_retries, backoff / 1000,
+            sp_playlist_name(pl));
+    arm(d, DL_RETRY, backoff);
+    return 1;
+}
+
+/* how many deadlines the playlist has missed */
+int
+deadline_attempts(sp_playlist *pl)
+{
+    struct deadline *d = find(pl, 0);
+    return d ? d->attempts : 0;
+}
+
+/* the playlist is done with, cancel its timer */
+void
+deadline_forget(sp_playlist *pl)
+{
+    struct deadline **dp, *d;
+
+    if (g_nbuckets == 0) {
+        return;
+    }
+    for (dp = &g_buckets[bucket(pl, g_nbuckets)]; (d = *dp); dp = &d->next) {
+        if (d->pl == pl) {
+            *dp = d->next;
+            set_backing_off(d, 0);
+            free(d);
+            g_count--;
+            return;
+        }
+    }
+}
+
+/* take the next timer that is due, returning 0 if there is none */
+int
+deadline_expired(sp_playlist **pl, int *kind)
+{
+    struct deadline *d;
+
+    prune();
+    if (g_heap_len == 0 || g_heap[0].when > now_ms()) {
+        return 0;
+    }
+    *pl = g_heap[0].pl;
+    *kind = g_heap[0].kind;
+    d = find(*pl, 0);
+    d->gen++; /* it has fired */
+    set_backing_off(d, 0);
+    heap_pop();
+    return 1;
+}
+
+/* playlists sitting out a backoff, which aren't on any queue meanwhile */
+int
+deadline_backing_off(void)
+{
+    return g_backing_off;
+}
+
+/* milliseconds until the next timer is due, or -1 if none is armed */
+int
+deadline_wait_ms(void)
+{
+    double ms;
+
+    prune();
+    if (g_heap_len == 0) {
+        return -1;
+    }
+    ms = g_heap[0].when - now_ms();
+    return ms > 0 ? (int)ms + 1 : 0;
+}
+
+void
+print_deadlines(char *prefix)
+{
+    fprintf(stderr, "%s timeouts=%lu retries=%lu given_up=%lu armed=%zu\n",
+            prefix, g_timeouts, g_retried, g_given_up, g_heap_len);
+}
@@ -0,0 +1,11 @@
+enum { DL_TIMEOUT, DL_RETRY };
+
+void deadline_init(int timeout_ms, int retries, int backoff_ms);
+void deadline_fetch(sp_playlist *);
+int deadline_retry(sp_playlist *);
+int deadline_attempts(sp_playlist *);
+void deadline_forget(sp_playlist *);
+int deadline_expired(sp_playlist **, int *kind);
+int deadline_backing_off(void);
+int deadline_wait_ms(void);
+void print_deadlines(char *);
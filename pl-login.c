@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libspotify/api.h>
+
+#include "pl-login.h"
+
+/*
+ * Login for warm starts, and how long startup took.
+ *
+ * With --credentials, the blob libspotify hands to credentials_blob_updated
+ * after a login is saved to that file, and the next run logs in with it
+ * instead of a password, so -p can be left out of crontabs.  If the blob
+ * is refused and -p was given as well, px logs in again with the password
+ * and the file is refreshed from the blob that login brings.  The file is
+ * written to a temporary name, synced and renamed, and only its owner may
+ * read it.
+ *
+ * The other half of a warm start is the cache under --cache, where
+ * libspotify keeps the rootlist and playlists from earlier runs so it
+ * doesn't sync them from scratch.  The START line shows what both bought:
+ * milliseconds from startup to logged_in and to container_loaded.
+ * Main thread only.
+ */
+
+/* a blob is a few hundred bytes */
+#define BLOB_MAX 4096
+
+static const char *g_path;
+static char *g_blob;
+static const char *g_username, *g_password;
+static int g_via_blob, g_retried;
+static double g_start, g_logged_in, g_container;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* the saved blob, or NULL if there is none */
+static char *
+read_blob(const char *path)
+{
+    char buf[BLOB_MAX];
+    ssize_t n;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "credentials %s: %s\n", path, strerror(errno));
+        }
+        return NULL;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r')) {
+        n--;
+    }
+    if (n <= 0) {
+        return NULL;
+    }
+    buf[n] = '\0';
+    return strdup(buf);
+}
+
+/**
+ * Start the clock for the START line, and read the blob saved in
+ * credentials if that is set.
+ * Returns whether there is a blob to log in with.
+ */
+int
+login_init(const char *credentials)
+{
+    g_start = now_ms();
+    g_path = credentials;
+    if (g_path) {
+        g_blob = read_blob(g_path);
+    }
+    return g_blob != NULL;
+}
+
+/* log in with the saved blob if there is one, else with the password */
+void
+login_start(sp_session *sp, const char *username, const char *password)
+{
+    g_username = username;
+    g_password = password;
+    g_via_blob = g_blob != NULL;
+    sp_session_login(sp, username, g_via_blob ? NULL : password, 0, g_blob);
+}
+
+/**
+ * A login failed.  Returns 0 if it has been tried again with the password,
+ * having been a login with a blob that has gone stale.
+ */
+int
+login_failed(sp_session *sp, sp_error error)
+{
+    if (!g_via_blob || g_password == NULL || g_retried) {
+        return -1;
+    }
+    fprintf(stderr, "credentials %s refused (%s), logging in with the password\n",
+            g_path, sp_error_message(error));
+    g_retried = 1;
+    g_via_blob = 0;
+    sp_session_login(sp, g_username, g_password, 0, NULL);
+    return 0;
+}
+
+/* save the blob libspotify has for this login, if it is a new one */
+void
+login_blob_updated(const char *blob)
+{
+    size_t n = strlen(blob), len;
+    char *tmp;
+    int fd;
+
+    if (g_path == NULL || (g_blob && strcmp(g_blob, blob) == 0)) {
+        return;
+    }
+    len = strlen(g_path) + 32;
+    tmp = malloc(len);
+    if (tmp == NULL) {
+        fprintf(stderr, "pl-login: out of memory\n");
+        exit(1);
+    }
+    snprintf(tmp, len, "%s.%d.tmp", g_path, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, blob, n) != (ssize_t)n || write(fd, "\n", 1) != 1 ||
+        fsync(fd) != 0 || rename(tmp, g_path) != 0) {
+        fprintf(stderr, "credentials %s: %s\n", g_path, strerror(errno));
+        unlink(tmp);
+    } else {
+        free(g_blob);
+        g_blob = strdup(blob);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(tmp);
+}
+
+/* note the time of logged_in, or of container_loaded if container is set */
+void
+login_mark(int container)
+{
+    double *t = container ? &g_container : &g_logged_in;
+
+    if (*t == 0) {
+        *t = now_ms() - g_start;
+    }
+}
+
+void
+print_login(char *prefix)
+{
+    fprintf(stderr, "%s via=%s retried=%d logged_in_ms=%.1f container_loaded_ms=%.1f\n",
+            prefix, g_via_blob ? "blob" : "password", g_retried, g_logged_in, g_container);
+}
@@ -0,0 +1,6 @@
+int login_init(const char *credentials);
+void login_start(sp_session *sp, const char *username, const char *password);
+int login_failed(sp_session *sp, sp_error error);
+void login_blob_updated(const char *blob);
+void login_mark(int container);
+void print_login(char *prefix);
@@ -0,0 +1,197 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "pl-mem.h"
+
+/*
+ * Memory budget for --mem-limit, and peak memory per phase of the run.
+ *
+ * libspotify keeps every playlist we hold a ref on in memory, along with
+ * the metadata of every track loaded for it, so resident size grows with
+ * the tracks fetched and hardly comes back down.  With a budget set, no
+ * more playlists are taken off the pending queue while
+ *
+ *     rss + outstanding tracks * bytes per track > limit
+ *
+ * Outstanding tracks are those of playlists in flight that haven't loaded
+ * yet: memory already committed to.  Bytes per track is learned as RSS
+ * growth over tracks loaded since fetching started.  One playlist is
+ * always let through when none is in flight, so a budget too small for
+ * even that slows the run down to one playlist at a time instead of
+ * stalling it.
+ *
+ * Resident size comes from /proc/self/statm.  Without it the budget can't
+ * be enforced, and only the getrusage high-water mark is reported.  A
+ * phase's peak is that high-water mark if it rose during the phase, and
+ * otherwise the highest sample taken in it.  Main thread only.
+ */
+
+#define MAX_PHASES 8
+/* tracks loaded before bytes per track is trusted */
+#define LEARN_TRACKS 200
+#define MB (1024.0 * 1024.0)
+
+struct phase {
+    const char *name;
+    size_t peak;            /* bytes */
+    size_t maxrss_before;
+};
+
+static size_t g_limit;
+static int g_statm = -1;
+static long g_page;
+
+static struct phase g_phases[MAX_PHASES];
+static int g_nphases;
+
+static size_t g_rss, g_base_rss;
+static long g_base_loaded = -1;
+static double g_per_track;
+
+static int g_paused;
+static unsigned long g_pauses;
+static double g_paused_since, g_paused_s;
+
+static double
+now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+maxrss(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss;
+#else
+    return (size_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+/* current resident size in bytes, or 0 if it can't be read */
+static size_t
+sample(void)
+{
+    char buf[64];
+    unsigned long size, resident;
+    ssize_t n;
+
+    if (g_statm < 0 || (n = pread(g_statm, buf, sizeof(buf) - 1, 0)) <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2) {
+        return 0;
+    }
+    g_rss = (size_t)resident * g_page;
+    if (g_nphases && g_rss > g_phases[g_nphases - 1].peak) {
+        g_phases[g_nphases - 1].peak = g_rss;
+    }
+    return g_rss;
+}
+
+void
+mem_init(size_t limit)
+{
+    g_limit = limit;
+    g_page = sysconf(_SC_PAGESIZE);
+    g_statm = open("/proc/self/statm", O_RDONLY);
+    if (g_statm < 0 && limit) {
+        fprintf(stderr, "MEM can't read resident size here, --mem-limit ignored\n");
+    }
+    mem_phase("login");
+}
+
+static void
+end_phase(void)
+{
+    struct phase *p = &g_phases[g_nphases - 1];
+    size_t high = maxrss();
+
+    sample();
+    if (high > p->maxrss_before) {
+        p->peak = high;
+    }
+}
+
+/* start the next phase of the run; its peak is tracked from here */
+void
+mem_phase(const char *name)
+{
+    if (g_nphases == MAX_PHASES) {
+        return;
+    }
+    if (g_nphases) {
+        end_phase();
+    }
+    g_phases[g_nphases].name = name;
+    g_phases[g_nphases].peak = 0;
+    g_phases[g_nphases].maxrss_before = maxrss();
+    g_nphases++;
+    sample();
+}
+
+/**
+ * Whether another playlist may be fetched, with working playlists in
+ * flight, loaded tracks loaded so far and outstanding still to come.
+ */
+int
+mem_allow(int working, long loaded, long outstanding)
+{
+    size_t rss = sample();
+    int allow;
+
+    if (rss == 0) {
+        return 1;
+    }
+    if (g_base_loaded < 0) {
+        g_base_loaded = loaded;
+        g_base_rss = rss;
+    } else if (loaded - g_base_loaded >= LEARN_TRACKS && rss > g_base_rss) {
+        g_per_track = (double)(rss - g_base_rss) / (loaded - g_base_loaded);
+    }
+    if (g_limit == 0) {
+        return 1;
+    }
+
+    allow = working == 0 || rss + outstanding * g_per_track <= g_limit;
+    if (!allow && !g_paused) {
+        g_paused = 1;
+        g_pauses++;
+        g_paused_since = now_s();
+        fprintf(stderr, "MEM over budget: rss=%.1fM outstanding=%ld per_track=%.0f, holding back\n",
+                rss / MB, outstanding, g_per_track);
+    } else if (allow && g_paused) {
+        g_paused = 0;
+        g_paused_s += now_s() - g_paused_since;
+    }
+    return allow;
+}
+
+void
+print_mem(char *prefix)
+{
+    int i;
+
+    end_phase();
+    if (g_paused) {
+        g_paused_s += now_s() - g_paused_since;
+        g_paused_since = now_s();
+    }
+    fprintf(stderr, "%s limit=%.1fM rss=%.1fM per_track=%.0f pauses=%lu paused_s=%.3f peak",
+            prefix, g_limit / MB, g_rss / MB, g_per_track, g_pauses, g_paused_s);
+    for (i = 0; i < g_nphases; i++) {
+        fprintf(stderr, " %s=%.1fM", g_phases[i].name, g_phases[i].peak / MB);
+    }
+    fprintf(stderr, "\n");
+}
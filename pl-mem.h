@@ -0,0 +1,4 @@
+void mem_init(size_t limit);
+void mem_phase(const char *name);
+int mem_allow(int working, long loaded, long outstanding);
+void print_mem(char *);
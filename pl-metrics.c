@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "link-cache.h"
+#include "pl-buf.h"
+#include "pl-metrics.h"
+#include "pl-queue.h"
+#include "pl-window.h"
+#include "pl-writer.h"
+
+/*
+ * Metrics file for --metrics, so a run can be graphed instead of grepped.
+ *
+ * Kept here: histograms of how long each playlist took from fetch to fully
+ * loaded and of the time spent formatting it in show_playlist, the links
+ * created for tracks and playlists (album and artist links come from the
+ * link cache's misses), when each phase of the run began, and the depth
+ * of the pending and working queues, the in-flight window and the writer
+ * queue, sampled every SAMPLE_MS.  Bytes written come from the writer.
+ *
+ * The file is rewritten every --metrics-interval seconds and at exit, to
+ * a temporary name renamed over the old one, so a reader never sees half
+ * of it.  As JSON it carries every queue sample taken; past MAX_SAMPLES,
+ * every other one is dropped and sampling slows down by half, so a long
+ * run keeps its whole shape at a coarser grain.  As Prometheus text
+ * (the node exporter's textfile collector takes it as it is) queues are
+ * gauges of the latest sample and the series comes from scraping.
+ * Main thread only.
+ */
+
+#define SAMPLE_MS 1000
+#define MAX_SAMPLES 4096
+#define NBOUNDS (sizeof(g_bounds) / sizeof(g_bounds[0]))
+#define MAX_PHASES 8
+
+enum { F_JSON, F_PROMETHEUS };
+
+/* bucket upper bounds in seconds, shared by both histograms */
+static const double g_bounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+    0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 600,
+};
+
+struct histogram {
+    const char *name, *help;
+    unsigned long buckets[NBOUNDS + 1];     /* the last is +Inf */
+    unsigned long count;
+    double sum;
+};
+
+struct sample {
+    double t;
+    int pending, working, window, writer;
+};
+
+static struct histogram g_hists[M_HISTOGRAMS] = {
+    { "playlist_load_seconds", "Time from fetching a playlist to all its tracks loaded." },
+    { "show_playlist_seconds", "Time spent formatting a playlist for output." },
+};
+static unsigned long g_counters[M_COUNTERS];
+
+static struct {
+    const char *name;
+    double start;
+} g_phases[MAX_PHASES];
+static int g_nphases;
+
+static struct sample g_samples[MAX_SAMPLES];
+static int g_nsamples;
+static double g_sample_ms = SAMPLE_MS;
+
+static char *g_path, *g_tmp;
+static int g_format;
+static double g_interval_ms, g_start, g_next_sample, g_next_write;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void write_file(void);
+static void write_final(void);
+
+int
+metrics_open(const char *path, const char *format, int interval_secs)
+{
+    size_t n = strlen(path) + 32;
+
+    if (format == NULL || strcmp(format, "json") == 0) {
+        g_format = F_JSON;
+    } else if (strcmp(format, "prometheus") == 0) {
+        g_format = F_PROMETHEUS;
+    } else {
+        fprintf(stderr, "metrics: unknown format %s\n", format);
+        return -1;
+    }
+    g_path = strdup(path);
+    g_tmp = malloc(n);
+    if (g_path == NULL || g_tmp == NULL) {
+        fprintf(stderr, "pl-metrics: out of memory\n");
+        exit(1);
+    }
+    snprintf(g_tmp, n, "%s.%d.tmp", path, (int)getpid());
+    g_interval_ms = interval_secs * 1000.0;
+    g_start = g_next_sample = now_ms();
+    g_next_write = g_start + g_interval_ms;
+    metrics_phase("login");
+    atexit(write_final);
+    return 0;
+}
+
+/* the run has moved on to the named phase */
+void
+metrics_phase(const char *name)
+{
+    if (g_path == NULL || g_nphases == MAX_PHASES) {
+        return;
+    }
+    g_phases[g_nphases].name = name;
+    g_phases[g_nphases].start = (now_ms() - g_start) / 1000;
+    g_nphases++;
+}
+
+void
+metrics_observe(int histogram, double secs)
+{
+    struct histogram *h = &g_hists[histogram];
+    size_t i = 0;
+
+    while (i < NBOUNDS && secs > g_bounds[i]) {
+        i++;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum += secs;
+}
+
+void
+metrics_count(int counter)
+{
+    g_counters[counter]++;
+}
+
+/* keep every other sample, and take half as many from now on */
+static void
+thin_samples(void)
+{
+    int i;
+
+    for (i = 0; 2 * i < g_nsamples; i++) {
+        g_samples[i] = g_samples[2 * i];
+    }
+    g_nsamples = i;
+    g_sample_ms *= 2;
+}
+
+static void
+take_sample(double now)
+{
+    struct sample *s;
+    unsigned long long written;
+
+    if (g_nsamples == MAX_SAMPLES) {
+        thin_samples();
+    }
+    s = &g_samples[g_nsamples++];
+    s->t = (now - g_start) / 1000;
+    s->pending = num_pending();
+    s->working = num_working();
+    s->window = window_size();
+    writer_totals(&s->writer, &written);
+}
+
+/* how long the main loop may sleep before metrics_tick has work to do */
+int
+metrics_wait_ms(void)
+{
+    double now = now_ms(), due = g_next_sample;
+
+    if (g_path == NULL) {
+        return -1;
+    }
+    if (g_next_write < due) {
+        due = g_next_write;
+    }
+    return due <= now ? 0 : (int)(due - now) + 1;
+}
+
+/* take a queue sample and write the file when they are due */
+void
+metrics_tick(void)
+{
+    double now = now_ms();
+
+    if (g_path == NULL) {
+        return;
+    }
+    if (now >= g_next_sample) {
+        take_sample(now);
+        g_next_sample = now + g_sample_ms;
+    }
+    if (now >= g_next_write) {
+        write_file();
+        g_next_write = now + g_interval_ms;
+    }
+}
+
+/* how long phase i lasted, or has lasted so far */
+static double
+phase_seconds(int i, double elapsed)
+{
+    return (i + 1 < g_nphases ? g_phases[i + 1].start : elapsed) - g_phases[i].start;
+}
+
+static void
+histogram_json(struct pl_buf *b, const struct histogram *h)
+{
+    size_t i;
+
+    buf_printf(b, "    \"%s\": {\"le\": [", h->name);
+    for (i = 0; i < NBOUNDS; i++) {
+        buf_printf(b, "%s%g", i ? ", " : "", g_bounds[i]);
+    }
+    buf_printf(b, ", \"+Inf\"], \"buckets\": [");
+    for (i = 0; i <= NBOUNDS; i++) {
+        buf_printf(b, "%s%lu", i ? ", " : "", h->buckets[i]);
+    }
+    buf_printf(b, "], \"count\": %lu, \"sum\": %.6f}", h->count, h->sum);
+}
+
+static void
+format_json(struct pl_buf *b, double elapsed, unsigned long albums, unsigned long artists,
+            unsigned long long written)
+{
+    int i;
+
+    buf_printf(b, "{\n  \"elapsed_seconds\": %.3f,\n  \"phases\": {", elapsed);
+    for (i = 0; i < g_nphases; i++) {
+        buf_printf(b, "%s\"%s\": {\"start\": %.3f, \"seconds\": %.3f}", i ? ", " : "",
+                   g_phases[i].name, g_phases[i].start, phase_seconds(i, elapsed));
+    }
+    buf_printf(b, "},\n  \"histograms\": {\n");
+    for (i = 0; i < M_HISTOGRAMS; i++) {
+        histogram_json(b, &g_hists[i]);
+        buf_printf(b, i + 1 < M_HISTOGRAMS ? ",\n" : "\n");
+    }
+    buf_printf(b, "  },\n  \"links_created\": {\"track\": %lu, \"playlist\": %lu, "
+               "\"album\": %lu, \"artist\": %lu},\n",
+               g_counters[M_TRACK_LINKS], g_counters[M_PLAYLIST_LINKS], albums, artists);
+    buf_printf(b, "  \"bytes_written\": %llu,\n", written);
+    buf_printf(b, "  \"queues\": {\"sample_seconds\": %g, "
+               "\"columns\": [\"t\", \"pending\", \"working\", \"window\", \"writer\"],\n"
+               "    \"samples\": [", g_sample_ms / 1000);
+    for (i = 0; i < g_nsamples; i++) {
+        const struct sample *s = &g_samples[i];
+        buf_printf(b, "%s[%.3f, %d, %d, %d, %d]", i ? ",\n      " : "\n      ",
+                   s->t, s->pending, s->working, s->window, s->writer);
+    }
+    buf_printf(b, "]}\n}\n");
+}
+
+static void
+histogram_prometheus(struct pl_buf *b, const struct histogram *h)
+{
+    unsigned long cumulative = 0;
+    size_t i;
+
+    buf_printf(b, "# HELP px_%s %s\n# TYPE px_%s histogram\n", h->name, h->help, h->name);
+    for (i = 0; i < NBOUNDS; i++) {
+        cumulative += h->buckets[i];
+        buf_printf(b, "px_%s_bucket{le=\"%g\"} %lu\n", h->name, g_bounds[i], cumulative);
+    }
+    buf_printf(b, "px_%s_bucket{le=\"+Inf\"} %lu\n", h->name, h->count);
+    buf_printf(b, "px_%s_sum %.6f\npx_%s_count %lu\n", h->name, h->sum, h->name, h->count);
+}
+
+static void
+format_prometheus(struct pl_buf *b, double elapsed, unsigned long albums,
+                  unsigned long artists, unsigned long long written)
+{
+    const struct sample *s = &g_samples[g_nsamples - 1];
+    int i;
+
+    buf_printf(b, "# HELP px_elapsed_seconds Time since px started.\n"
+               "# TYPE px_elapsed_seconds gauge\npx_elapsed_seconds %.3f\n", elapsed);
+    buf_printf(b, "# HELP px_phase_seconds Time spent in each phase of the run.\n"
+               "# TYPE px_phase_seconds gauge\n");
+    for (i = 0; i < g_nphases; i++) {
+        buf_printf(b, "px_phase_seconds{phase=\"%s\"} %.3f\n",
+                   g_phases[i].name, phase_seconds(i, elapsed));
+    }
+    for (i = 0; i < M_HISTOGRAMS; i++) {
+        histogram_prometheus(b, &g_hists[i]);
+    }
+    buf_printf(b, "# HELP px_links_created_total Links created, by kind.\n"
+               "# TYPE px_links_created_total counter\n"
+               "px_links_created_total{kind=\"track\"} %lu\n"
+               "px_links_created_total{kind=\"playlist\"} %lu\n"
+               "px_links_created_total{kind=\"album\"} %lu\n"
+               "px_links_created_total{kind=\"artist\"} %lu\n",
+               g_counters[M_TRACK_LINKS], g_counters[M_PLAYLIST_LINKS], albums, artists);
+    buf_printf(b, "# HELP px_written_bytes_total Bytes of dump written.\n"
+               "# TYPE px_written_bytes_total counter\npx_written_bytes_total %llu\n", written);
+    buf_printf(b, "# HELP px_queue_depth Playlists or buffers in each queue.\n"
+               "# TYPE px_queue_depth gauge\n"
+               "px_queue_depth{queue=\"pending\"} %d\n"
+               "px_queue_depth{queue=\"working\"} %d\n"
+               "px_queue_depth{queue=\"writer\"} %d\n", s->pending, s->working, s->writer);
+    buf_printf(b, "# HELP px_inflight_window Playlists allowed to load at once.\n"
+               "# TYPE px_inflight_window gauge\npx_inflight_window %d\n", s->window);
+}
+
+/* write everything out, replacing the last file */
+static void
+write_file(void)
+{
+    struct pl_buf b;
+    unsigned long albums, artists;
+    unsigned long long written;
+    double now = now_ms();
+    int fd, dummy;
+
+    link_cache_created(&albums, &artists);
+    writer_totals(&dummy, &written);
+
+    buf_init(&b, 64 * 1024);
+    if (g_format == F_JSON) {
+        format_json(&b, (now - g_start) / 1000, albums, artists, written);
+    } else {
+        format_prometheus(&b, (now - g_start) / 1000, albums, artists, written);
+    }
+    fd = open(g_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || buf_flush(&b, fd) != 0 || rename(g_tmp, g_path) != 0) {
+        fprintf(stderr, "metrics %s: %s\n", g_path, strerror(errno));
+        unlink(g_tmp);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    buf_free(&b);
+}
+
+/* at exit, with the queues as they were left */
+static void
+write_final(void)
+{
+    take_sample(now_ms());
+    write_file();
+}
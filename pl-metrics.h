@@ -0,0 +1,9 @@
+enum { M_LOAD, M_SHOW, M_HISTOGRAMS };
+enum { M_TRACK_LINKS, M_PLAYLIST_LINKS, M_COUNTERS };
+
+int metrics_open(const char *path, const char *format, int interval_secs);
+void metrics_phase(const char *name);
+void metrics_observe(int histogram, double secs);
+void metrics_count(int counter);
+int metrics_wait_ms(void);
+void metrics_tick(void);
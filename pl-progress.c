@@ -0,0 +1,292 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libspotify/api.h>
+
+#include "pl-progress.h"
+
+/*
+ * Incremental load tracking for playlists.
+ *
+ * For each playlist we remember how many leading tracks are known to be
+ * loaded.  Tracks never go from loaded back to loading, so an update only
+ * has to look at tracks past that cursor, and stops at the first one still
+ * loading.  Over a whole load each track is looked at about once instead
+ * of once per metadata callback.
+ *
+ * A track libspotify hasn't loaded yet still counts if the fallback set
+ * with progress_fallback() can supply it, e.g. from the track cache.
+ *
+ * Totals over all playlists, of tracks seen loaded and tracks still
+ * outstanding, are kept for the memory budget in pl-mem.c.
+ *
+ * With --stream, tracks [0, taken) have been written out already.  An
+ * edit that reaches into them, or that leaves fewer tracks than that,
+ * marks the playlist spliced: progress_take hands out nothing more, and
+ * the playlist is ended incomplete rather than written as a mix of the
+ * old and new track lists.
+ */
+
+struct progress {
+    sp_playlist *pl;
+    int num_tracks;     /* track count the cursor was computed against */
+    int loaded;         /* tracks [0, loaded) are known to be loaded */
+    int taken;          /* tracks [0, taken) were handed out by progress_take */
+    int spliced;        /* edited inside [0, taken) since */
+    int outstanding;    /* as of the last update, counted in g_outstanding */
+    double started;     /* when loading was requested, see progress_start */
+    struct progress *next;
+};
+
+static struct progress **g_buckets;
+static size_t g_nbuckets, g_count;
+static pthread_mutex_t g_progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int (*g_fallback)(sp_track *);
+static long g_loaded, g_outstanding;
+
+static size_t
+bucket(sp_playlist *pl, size_t n)
+{
+    uintptr_t x = (uintptr_t)pl;
+    x ^= x >> 17;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (x >> 20) & (n - 1);
+}
+
+static void
+rehash(void)
+{
+    size_t n = g_nbuckets ? 2 * g_nbuckets : 256, i;
+    struct progress **b = calloc(n, sizeof(*b));
+
+    if (b == NULL) {
+        fprintf(stderr, "pl-progress: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < g_nbuckets; i++) {
+        struct progress *p = g_buckets[i], *next;
+        for (; p; p = next) {
+            size_t k = bucket(p->pl, n);
+            next = p->next;
+            p->next = b[k];
+            b[k] = p;
+        }
+    }
+    free(g_buckets);
+    g_buckets = b;
+    g_nbuckets = n;
+}
+
+static struct progress *
+find(sp_playlist *pl, int create)
+{
+    struct progress *p;
+    size_t k;
+
+    if (g_nbuckets) {
+        for (p = g_buckets[bucket(pl, g_nbuckets)]; p; p = p->next) {
+            if (p->pl == pl) {
+                return p;
+            }
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (g_count >= g_nbuckets) {
+        rehash();
+    }
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        fprintf(stderr, "pl-progress: out of memory\n");
+        exit(1);
+    }
+    p->pl = pl;
+    p->num_tracks = -1;
+    k = bucket(pl, g_nbuckets);
+    p->next = g_buckets[k];
+    g_buckets[k] = p;
+    g_count++;
+    return p;
+}
+
+/*
+ * Advance the playlist's loaded cursor and return the number of tracks
+ * still outstanding.  *num_tracks is set to the playlist's track count.
+ */
+int
+progress_update(sp_playlist *pl, int *num_tracks)
+{
+    struct progress *p;
+    int nt = sp_playlist_num_tracks(pl);
+    int outstanding;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 1);
+    if (p->num_tracks != nt) {
+        /* tracks were added or removed under us, start over */
+        p->num_tracks = nt;
+        g_loaded -= p->loaded; /* counted again as the cursor gets back there */
+        p->loaded = 0;
+        if (nt < p->taken) {
+            p->spliced = 1;
+        }
+    }
+    while (p->loaded < nt) {
+        sp_track *st = sp_playlist_track(pl, p->loaded);
+        if (st == NULL || (sp_track_error(st) != SP_ERROR_OK &&
+                           !(g_fallback && g_fallback(st)))) {
+            break;
+        }
+        p->loaded++;
+        g_loaded++;
+    }
+    outstanding = nt - p->loaded;
+    g_outstanding += outstanding - p->outstanding;
+    p->outstanding = outstanding;
+    pthread_mutex_unlock(&g_progress_mutex);
+
+    if (num_tracks) {
+        *num_tracks = nt;
+    }
+    return outstanding;
+}
+
+/* treat tracks for which fn returns true as loaded */
+void
+progress_fallback(int (*fn)(sp_track *))
+{
+    g_fallback = fn;
+}
+
+/*
+ * Hand out the tracks loaded since the last call, for streaming them out:
+ * returns the end of the loaded prefix and sets *from to where the last
+ * call left off.  Call after progress_update.
+ */
+int
+progress_take(sp_playlist *pl, int *from)
+{
+    struct progress *p;
+    int to;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 1);
+    *from = p->taken;
+    if (p->loaded > p->taken && !p->spliced) {
+        p->taken = p->loaded;
+    }
+    to = p->taken;
+    pthread_mutex_unlock(&g_progress_mutex);
+    return to;
+}
+
+/* how many tracks progress_take has handed out */
+int
+progress_taken(sp_playlist *pl)
+{
+    struct progress *p;
+    int taken;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 0);
+    taken = p ? p->taken : 0;
+    pthread_mutex_unlock(&g_progress_mutex);
+    return taken;
+}
+
+/* note an edit to the playlist's tracks from index first on */
+void
+progress_edited(sp_playlist *pl, int first)
+{
+    struct progress *p;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 0);
+    if (p && first < p->taken) {
+        p->spliced = 1;
+    }
+    pthread_mutex_unlock(&g_progress_mutex);
+}
+
+/* whether an edit reached into the tracks progress_take handed out */
+int
+progress_spliced(sp_playlist *pl)
+{
+    struct progress *p;
+    int spliced;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 0);
+    spliced = p ? p->spliced : 0;
+    pthread_mutex_unlock(&g_progress_mutex);
+    return spliced;
+}
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* note that we've asked libspotify to load this playlist */
+void
+progress_start(sp_playlist *pl)
+{
+    pthread_mutex_lock(&g_progress_mutex);
+    find(pl, 1)->started = now_ms();
+    pthread_mutex_unlock(&g_progress_mutex);
+}
+
+/* milliseconds since progress_start, or -1 if it was never started */
+double
+progress_elapsed(sp_playlist *pl)
+{
+    struct progress *p;
+    double ms = -1;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    p = find(pl, 0);
+    if (p && p->started > 0) {
+        ms = now_ms() - p->started;
+    }
+    pthread_mutex_unlock(&g_progress_mutex);
+    return ms;
+}
+
+void
+progress_forget(sp_playlist *pl)
+{
+    struct progress **pp, *p;
+
+    pthread_mutex_lock(&g_progress_mutex);
+    if (g_nbuckets) {
+        for (pp = &g_buckets[bucket(pl, g_nbuckets)]; (p = *pp); pp = &p->next) {
+            if (p->pl == pl) {
+                *pp = p->next;
+                g_outstanding -= p->outstanding;
+                free(p);
+                g_count--;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_progress_mutex);
+}
+
+/* tracks seen loaded over the whole run, and still outstanding now */
+void
+progress_totals(long *loaded, long *outstanding)
+{
+    pthread_mutex_lock(&g_progress_mutex);
+    *loaded = g_loaded;
+    *outstanding = g_outstanding;
+    pthread_mutex_unlock(&g_progress_mutex);
+}
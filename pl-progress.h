@@ -0,0 +1,10 @@
+int progress_update(sp_playlist *, int *);
+int progress_take(sp_playlist *, int *);
+int progress_taken(sp_playlist *);
+void progress_edited(sp_playlist *, int first);
+int progress_spliced(sp_playlist *);
+void progress_forget(sp_playlist *);
+void progress_start(sp_playlist *);
+double progress_elapsed(sp_playlist *);
+void progress_fallback(int (*)(sp_track *));
+void progress_totals(long *loaded, long *outstanding);
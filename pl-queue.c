@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <limits.h>
 #include <libgen.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -6,161 +7,433 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
-#include <sys/queue.h>
 
 /* only needed for typedefs */
 #include <libspotify/api.h>
 
-enum { HEAD, TAIL };
+/*
+ * The working queue is a list of entries from a pool.  Entries are linked
+ * by index rather than pointer so the pool can be grown with realloc,
+ * freed entries go on a free list for reuse, and an open addressing index
+ * from (playlist, queue) to entry makes lookup and removal O(1) instead of
+ * a walk of the list.
+ *
+ * The pending queue is a binary heap ordered by the key it was queued
+ * with (see pl-sched.c), ties broken by queueing order.
+ */
 
-typedef STAILQ_HEAD(pl_queue_t, pl_queue_entry) pl_queue;
+enum { HEAD, TAIL };
+enum { WORKING, NUM_QUEUES };
 
-static pl_queue playlists_pending;
-static pl_queue playlists_working;
+#define NIL UINT32_MAX
 
 struct pl_queue_entry {
-    sp_playlist *pl; /* our queued playlist */
-    STAILQ_ENTRY(pl_queue_entry) entries;
+    sp_playlist *pl; /* our queued playlist, NULL while on the free list */
+    uint32_t prev, next;
+    int queue;
 };
 
-void
-init_playlist_queue(pl_queue *playlist) {
-    STAILQ_INIT(playlist);
+struct pl_queue {
+    uint32_t head, tail;
+    int count;
+};
+
+struct pl_heap_entry {
+    long key;
+    unsigned long seq;
+    sp_playlist *pl;
+};
+
+static struct pl_queue_entry *pool;
+static uint32_t pool_cap;
+static uint32_t pool_free = NIL;
+
+static struct pl_queue queues[NUM_QUEUES] = {
+    { NIL, NIL, 0 },
+};
+
+static struct pl_heap_entry *pending;
+static size_t pending_len, pending_cap;
+static unsigned long pending_seq;
+
+/* entry index per slot, NIL when empty; kept at most half full */
+static uint32_t *index_slots;
+static uint32_t index_cap;
+static uint32_t index_used;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (p == NULL) {
+        fprintf(stderr, "pl-queue: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static uint32_t
+slot_of(sp_playlist *pl, int queue)
+{
+    uint64_t h = (uintptr_t)pl ^ queue;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h & (index_cap - 1);
+}
+
+static void
+index_insert(uint32_t e)
+{
+    uint32_t i = slot_of(pool[e].pl, pool[e].queue);
+
+    while (index_slots[i] != NIL) {
+        i = (i + 1) & (index_cap - 1);
+    }
+    index_slots[i] = e;
+    index_used++;
+}
+
+static void
+index_grow(void)
+{
+    uint32_t *old = index_slots;
+    uint32_t old_cap = index_cap, i;
+
+    index_cap = old_cap ? 2 * old_cap : 64;
+    index_slots = xrealloc(NULL, index_cap * sizeof(*index_slots));
+    memset(index_slots, 0xff, index_cap * sizeof(*index_slots));
+    index_used = 0;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i] != NIL) {
+            index_insert(old[i]);
+        }
+    }
+    free(old);
+}
+
+/* slot holding the entry for pl on queue, or NIL */
+static uint32_t
+index_find(sp_playlist *pl, int queue)
+{
+    uint32_t i;
+
+    if (index_cap == 0) {
+        return NIL;
+    }
+    for (i = slot_of(pl, queue); index_slots[i] != NIL; i = (i + 1) & (index_cap - 1)) {
+        struct pl_queue_entry *t = &pool[index_slots[i]];
+        if (t->pl == pl && t->queue == queue) {
+            return i;
+        }
+    }
+    return NIL;
+}
+
+/* slot holding entry e itself, which may share its key with a duplicate */
+static uint32_t
+index_find_entry(uint32_t e)
+{
+    uint32_t i = slot_of(pool[e].pl, pool[e].queue);
+
+    while (index_slots[i] != e) {
+        i = (i + 1) & (index_cap - 1);
+    }
+    return i;
+}
+
+/* empty slot i, shifting later entries of its probe run back into place */
+static void
+index_delete(uint32_t i)
+{
+    uint32_t mask = index_cap - 1, j = i, k;
+
+    index_slots[i] = NIL;
+    index_used--;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (index_slots[j] == NIL) {
+            return;
+        }
+        k = slot_of(pool[index_slots[j]].pl, pool[index_slots[j]].queue);
+        /* leave it if its home lies cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        index_slots[i] = index_slots[j];
+        index_slots[j] = NIL;
+        i = j;
+    }
+}
+
+static uint32_t
+entry_alloc(void)
+{
+    uint32_t e;
+
+    if (pool_free == NIL) {
+        uint32_t n = pool_cap ? 2 * pool_cap : 64;
+        pool = xrealloc(pool, n * sizeof(*pool));
+        for (e = n; e-- > pool_cap; ) {
+            pool[e].pl = NULL;
+            pool[e].next = pool_free;
+            pool_free = e;
+        }
+        pool_cap = n;
+    }
+    e = pool_free;
+    pool_free = pool[e].next;
+    return e;
+}
+
+static void
+entry_free(uint32_t e)
+{
+    pool[e].pl = NULL;
+    pool[e].next = pool_free;
+    pool_free = e;
+}
+
+static void
+unlink_entry(uint32_t e)
+{
+    struct pl_queue *q = &queues[pool[e].queue];
+    struct pl_queue_entry *t = &pool[e];
+
+    if (t->prev == NIL) {
+        q->head = t->next;
+    } else {
+        pool[t->prev].next = t->next;
+    }
+    if (t->next == NIL) {
+        q->tail = t->prev;
+    } else {
+        pool[t->next].prev = t->prev;
+    }
+    q->count--;
+}
+
+static void
+remove_entry(uint32_t e)
+{
+    index_delete(index_find_entry(e));
+    unlink_entry(e);
+    entry_free(e);
+}
+
+/* take pl off queue, returning 1 if it was there */
+static int
+remove_playlist(sp_playlist *pl, int queue)
+{
+    uint32_t slot = index_find(pl, queue);
+
+    if (slot == NIL) {
+        return 0;
+    }
+    remove_entry(index_slots[slot]);
+    return 1;
 }
 
 void
 init_playlist_queues() {
-    init_playlist_queue(&playlists_pending);
-    init_playlist_queue(&playlists_working);
+    int i;
+
+    for (i = 0; i < NUM_QUEUES; i++) {
+        queues[i].head = queues[i].tail = NIL;
+        queues[i].count = 0;
+    }
+    pending_len = 0;
 }
 
 void
-queue_playlist(sp_playlist *pl, pl_queue *playlist, int end) {
+queue_playlist(sp_playlist *pl, int queue, int end) {
     /* and a partridge in a pear tree */
-    struct pl_queue_entry *t = (struct pl_queue_entry *)malloc(sizeof(struct pl_queue_entry));
+    struct pl_queue *q = &queues[queue];
+    uint32_t e = entry_alloc();
+    struct pl_queue_entry *t = &pool[e];
+
     t->pl = pl;
+    t->queue = queue;
     if (end == HEAD) {
-        STAILQ_INSERT_HEAD(playlist, t, entries);
+        t->prev = NIL;
+        t->next = q->head;
+        if (q->head == NIL) {
+            q->tail = e;
+        } else {
+            pool[q->head].prev = e;
+        }
+        q->head = e;
     } else {
-        STAILQ_INSERT_TAIL(playlist, t, entries);
+        t->prev = q->tail;
+        t->next = NIL;
+        if (q->tail == NIL) {
+            q->head = e;
+        } else {
+            pool[q->tail].next = e;
+        }
+        q->tail = e;
     }
+    q->count++;
+
+    if (2 * (index_used + 1) > index_cap) {
+        index_grow();
+    }
+    index_insert(e);
+}
+
+static int
+heap_before(const struct pl_heap_entry *a, const struct pl_heap_entry *b)
+{
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
 }
 
 void
-queue_pending(sp_playlist *pl) {
-    queue_playlist(pl, &playlists_pending, TAIL);
+queue_pending(sp_playlist *pl, long key) {
+    struct pl_heap_entry t;
+    size_t i;
+
+    if (pending_len == pending_cap) {
+        pending_cap = pending_cap ? 2 * pending_cap : 64;
+        pending = xrealloc(pending, pending_cap * sizeof(*pending));
+    }
+
+    t.key = key;
+    t.seq = pending_seq++;
+    t.pl = pl;
+    for (i = pending_len++; i > 0 && heap_before(&t, &pending[(i - 1) / 2]); i = (i - 1) / 2) {
+        pending[i] = pending[(i - 1) / 2];
+    }
+    pending[i] = t;
 }
 
 void
 queue_pending_first(sp_playlist *pl) {
-    queue_playlist(pl, &playlists_pending, HEAD);
+    queue_pending(pl, LONG_MIN);
 }
 
 void
 queue_working(sp_playlist *pl) {
-    queue_playlist(pl, &playlists_working, TAIL);
+    queue_playlist(pl, WORKING, TAIL);
 }
 
 sp_playlist *
-dequeue_playlist(pl_queue *playlist) {
+dequeue_pending(void) {
     sp_playlist *r_pl;
-    struct pl_queue_entry *t;
+    struct pl_heap_entry last;
+    size_t i, child;
 
-    /* empty list returns NULL on dequeue */
-    if (STAILQ_EMPTY(playlist)) {
-       return NULL;
+    if (pending_len == 0) {
+        return NULL;
     }
+    r_pl = pending[0].pl;
 
-    t = STAILQ_FIRST(playlist);
-    r_pl = t->pl; /* save our playlist pointer */
-
-    /* no need for the queue entry any more */
-    STAILQ_REMOVE_HEAD(playlist, entries);
-    free(t);
+    /* sift the last entry down from the root */
+    last = pending[--pending_len];
+    for (i = 0; (child = 2 * i + 1) < pending_len; i = child) {
+        if (child + 1 < pending_len && heap_before(&pending[child + 1], &pending[child])) {
+            child++;
+        }
+        if (!heap_before(&pending[child], &last)) {
+            break;
+        }
+        pending[i] = pending[child];
+    }
+    pending[i] = last;
 
     return r_pl;
 }
 
-sp_playlist *
-dequeue_pending(void) {
-    return dequeue_playlist(&playlists_pending);
-}
-
 void
 remove_working(sp_playlist *pl) {
-    // remove this playlist from the work list somehow
-    struct pl_queue_entry *np;
-
-    STAILQ_FOREACH(np, &playlists_working, entries) {
-        if (np->pl == pl) {
-            fprintf(stderr, "W-  %s\n", sp_playlist_name(np->pl));
-            STAILQ_REMOVE(&playlists_working, np, pl_queue_entry, entries);
-        } else {
-            fprintf(stderr, "W=  %s\n", sp_playlist_name(np->pl));
-        }
+    if (remove_playlist(pl, WORKING)) {
+        fprintf(stderr, "W-  %s\n", sp_playlist_name(pl));
     }
 }
 
+int
+is_working(sp_playlist *pl) {
+    return index_find(pl, WORKING) != NIL;
+}
+
+int
+num_working(void) {
+    return queues[WORKING].count;
+}
+
+int
+num_pending(void) {
+    return (int)pending_len;
+}
+
 int
 still_working(void) {
-    return ! STAILQ_EMPTY(&playlists_working);
+    return queues[WORKING].count != 0;
 }
 
 int
 still_pending(void) {
-    return ! STAILQ_EMPTY(&playlists_pending);
+    return pending_len != 0;
 }
 
 int
 deinit_finished_working(int(*seek)(sp_playlist*),void(*destroy)(sp_playlist*)) {
-    struct pl_queue_entry *np;
+    uint32_t e, next;
     int rv = 0;
 
-    STAILQ_FOREACH(np, &playlists_working, entries) {
-        if ((*seek)(np->pl)) { // remove from working
-            fprintf(stderr, "W!  %s\n", sp_playlist_name(np->pl));
-            (*destroy)(np->pl);
+    /* destroy unlinks the entry, so step past it first */
+    for (e = queues[WORKING].head; e != NIL; e = next) {
+        sp_playlist *pl = pool[e].pl;
+
+        next = pool[e].next;
+        if ((*seek)(pl)) { // remove from working
+            fprintf(stderr, "W!  %s\n", sp_playlist_name(pl));
+            (*destroy)(pl);
             rv = 1; /* we've removed a playlist => free slot */
         } else {
-            fprintf(stderr, "W?  %s\n", sp_playlist_name(np->pl));
+            fprintf(stderr, "W?  %s\n", sp_playlist_name(pl));
         }
     }
 
     return rv;
 }
 
-void
-print_working(char *prefix)
+static void
+print_queue(int queue, char *prefix)
 {
-    struct pl_queue_entry *np;
+    uint32_t e;
     int i=0;
 
-    if (STAILQ_EMPTY(&playlists_working)) {
+    if (queues[queue].head == NIL) {
         fprintf(stderr, "Q. %s EMPTY\n", prefix);
         return;
     }
 
-    STAILQ_FOREACH(np, &playlists_working, entries) {
-        fprintf(stderr, "Q. %s %d %p %s\n", prefix, i, np->pl,
-                np->pl ? sp_playlist_name(np->pl) : "[NULL]");
+    for (e = queues[queue].head; e != NIL; e = pool[e].next) {
+        fprintf(stderr, "Q. %s %d %p %s\n", prefix, i, pool[e].pl,
+                pool[e].pl ? sp_playlist_name(pool[e].pl) : "[NULL]");
         i++;
     }
 }
 
+void
+print_working(char *prefix)
+{
+    print_queue(WORKING, prefix);
+}
+
+/* in heap order, not the order they'll be fetched in */
 void
 print_pending(char *prefix)
 {
-    struct pl_queue_entry *np;
-    int i=0;
+    size_t i;
 
-    if (STAILQ_EMPTY(&playlists_pending)) {
+    if (pending_len == 0) {
         fprintf(stderr, "Q. %s EMPTY\n", prefix);
         return;
     }
 
-    STAILQ_FOREACH(np, &playlists_pending, entries) {
-        fprintf(stderr, "Q. %s %d %p %s\n", prefix, i, np->pl,
-                np->pl ? sp_playlist_name(np->pl) : "[NULL]");
-        i++;
+    for (i = 0; i < pending_len; i++) {
+        fprintf(stderr, "Q. %s %d %p %s key=%ld\n", prefix, (int)i, pending[i].pl,
+                pending[i].pl ? sp_playlist_name(pending[i].pl) : "[NULL]", pending[i].key);
     }
 }
@@ -1,10 +1,13 @@
 void init_playlist_queues(void);
-void queue_pending(sp_playlist *);
+void queue_pending(sp_playlist *, long);
 void queue_pending_first(sp_playlist *);
 sp_playlist *dequeue_pending(void);
 void queue_working(sp_playlist *);
 void remove_working(sp_playlist *);
 int deinit_finished_working(int(*grep)(sp_playlist *),void(*kill)(sp_playlist*));
+int is_working(sp_playlist *);
+int num_working(void);
+int num_pending(void);
 int still_working(void);
 int still_pending(void);
 void print_working(char *);
@@ -0,0 +1,348 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pl-raw.h"
+
+#define HEADER_WORDS 10
+#define TRACK_WORDS 10
+#define ARTIST_WORDS 2
+
+enum { H_LENGTH, H_FLAGS, H_TOTAL, H_TRACKS, H_ARTISTS, H_STRINGS,
+       H_URI, H_NAME, H_OWNER, H_DESCRIPTION };
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void *
+grow(void *buf, size_t *cap, size_t need, size_t size)
+{
+    size_t n = *cap ? *cap : 64;
+
+    if (need <= *cap) {
+        return buf;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    buf = realloc(buf, n * size);
+    if (buf == NULL) {
+        fprintf(stderr, "pl-raw: out of memory\n");
+        exit(1);
+    }
+    *cap = n;
+    return buf;
+}
+
+/* --------------------------------  WRITING  ------------------------------ */
+
+void
+raw_builder_init(struct raw_builder *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+static uint32_t
+fnv1a(const char *s, size_t len)
+{
+    uint32_t h = 2166136261U;
+    while (len--) {
+        h = (h ^ (unsigned char)*s++) * 16777619U;
+    }
+    return h;
+}
+
+/* store a string once per record, returning its offset */
+static uint32_t
+intern(struct raw_builder *b, const char *s)
+{
+    size_t len, i, mask;
+    uint32_t h, off;
+
+    if (s == NULL) {
+        return RAW_NONE;
+    }
+
+    /* keep the table at most half full */
+    if (2 * (b->slots_used + 1) > b->slots_cap) {
+        struct raw_string_slot *old = b->slots;
+        size_t old_cap = b->slots_cap;
+
+        b->slots_cap = old_cap ? 2 * old_cap : 256;
+        b->slots = calloc(b->slots_cap, sizeof(*b->slots));
+        if (b->slots == NULL) {
+            fprintf(stderr, "pl-raw: out of memory\n");
+            exit(1);
+        }
+        mask = b->slots_cap - 1;
+        for (i = 0; i < old_cap; i++) {
+            if (old[i].hash) {
+                size_t j = old[i].hash & mask;
+                while (b->slots[j].hash) {
+                    j = (j + 1) & mask;
+                }
+                b->slots[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    len = strlen(s);
+    h = fnv1a(s, len) | 1; /* never zero, so zeroed slots are empty */
+    mask = b->slots_cap - 1;
+    for (i = h & mask; b->slots[i].hash; i = (i + 1) & mask) {
+        if (b->slots[i].hash == h && strcmp(b->strings + b->slots[i].offset, s) == 0) {
+            return b->slots[i].offset;
+        }
+    }
+
+    off = b->strings_len;
+    b->strings = grow(b->strings, &b->strings_cap, b->strings_len + len + 1, 1);
+    memcpy(b->strings + off, s, len + 1);
+    b->strings_len += len + 1;
+
+    b->slots[i].hash = h;
+    b->slots[i].offset = off;
+    b->slots_used++;
+    return off;
+}
+
+void
+raw_begin(struct raw_builder *b, const char *uri, int total_tracks,
+          const char *name, const char *owner, const char *description)
+{
+    b->tracks_len = 0;
+    b->artists_len = 0;
+    b->strings_len = 0;
+    b->num_tracks = 0;
+    b->num_artists = 0;
+    if (b->slots_used) {
+        memset(b->slots, 0, b->slots_cap * sizeof(*b->slots));
+        b->slots_used = 0;
+    }
+
+    b->header[H_FLAGS] = 0;
+    b->header[H_TOTAL] = total_tracks;
+    b->header[H_URI] = intern(b, uri);
+    b->header[H_NAME] = intern(b, name);
+    b->header[H_OWNER] = intern(b, owner);
+    b->header[H_DESCRIPTION] = intern(b, description);
+}
+
+void
+raw_track(struct raw_builder *b, int index, const char *creator,
+          const char *uri, const char *name, int duration, int epoch,
+          const char *album_uri, const char *album_name)
+{
+    unsigned char *p;
+
+    b->tracks = grow(b->tracks, &b->tracks_cap, b->tracks_len + 4 * TRACK_WORDS, 1);
+    p = b->tracks + b->tracks_len;
+    b->tracks_len += 4 * TRACK_WORDS;
+    b->num_tracks++;
+
+    put32(p + 0, index);
+    put32(p + 4, duration);
+    put32(p + 8, epoch);
+    put32(p + 12, intern(b, creator));
+    put32(p + 16, intern(b, uri));
+    put32(p + 20, intern(b, name));
+    put32(p + 24, intern(b, album_uri));
+    put32(p + 28, intern(b, album_name));
+    put32(p + 32, b->num_artists);
+    put32(p + 36, 0);
+}
+
+void
+raw_artist(struct raw_builder *b, const char *uri, const char *name)
+{
+    unsigned char *p, *t;
+
+    if (b->num_tracks == 0) {
+        return;
+    }
+
+    b->artists = grow(b->artists, &b->artists_cap, b->artists_len + 4 * ARTIST_WORDS, 1);
+    p = b->artists + b->artists_len;
+    b->artists_len += 4 * ARTIST_WORDS;
+    b->num_artists++;
+
+    put32(p + 0, intern(b, uri));
+    put32(p + 4, intern(b, name));
+
+    /* bump the artist count of the track being built */
+    t = b->tracks + b->tracks_len - 4 * TRACK_WORDS;
+    put32(t + 36, get32(t + 36) + 1);
+}
+
+void
+raw_flags(struct raw_builder *b, uint32_t flags)
+{
+    b->header[H_FLAGS] |= flags;
+}
+
+/* assemble the finished record, valid until the next raw_begin */
+size_t
+raw_finish(struct raw_builder *b, const unsigned char **record)
+{
+    size_t len = 4 * HEADER_WORDS + b->tracks_len + b->artists_len + b->strings_len;
+    unsigned char *p;
+    int i;
+
+    b->header[H_LENGTH] = len - 4;
+    b->header[H_TRACKS] = b->num_tracks;
+    b->header[H_ARTISTS] = b->num_artists;
+    b->header[H_STRINGS] = b->strings_len;
+
+    b->out = grow(b->out, &b->out_cap, len, 1);
+    p = b->out;
+    for (i = 0; i < HEADER_WORDS; i++, p += 4) {
+        put32(p, b->header[i]);
+    }
+    memcpy(p, b->tracks, b->tracks_len);
+    p += b->tracks_len;
+    memcpy(p, b->artists, b->artists_len);
+    p += b->artists_len;
+    memcpy(p, b->strings, b->strings_len);
+
+    *record = b->out;
+    return len;
+}
+
+/* --------------------------------  READING  ------------------------------ */
+
+int
+raw_is_binary(FILE *fp)
+{
+    int c = getc(fp);
+
+    if (c == EOF) {
+        return 0;
+    }
+    ungetc(c, fp);
+    return c == (unsigned char)RAW_MAGIC[0];
+}
+
+int
+raw_reader_init(struct raw_reader *r, FILE *fp)
+{
+    char magic[RAW_MAGIC_LEN];
+
+    memset(r, 0, sizeof(*r));
+    r->fp = fp;
+
+    if (fread(magic, 1, RAW_MAGIC_LEN, fp) != RAW_MAGIC_LEN ||
+        memcmp(magic, RAW_MAGIC, RAW_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static const char *
+string_at(const char *strings, uint32_t len, uint32_t off)
+{
+    if (off == RAW_NONE || off >= len) {
+        return NULL;
+    }
+    return strings + off;
+}
+
+/*
+ * Read the next playlist record.  Returns 1 and points *pl at it (valid
+ * until the next call), 0 at end of stream, -1 on a malformed record.
+ */
+int
+raw_read_playlist(struct raw_reader *r, struct raw_playlist **pl)
+{
+    unsigned char lenbuf[4];
+    uint32_t len, h[HEADER_WORDS], i;
+    const unsigned char *p;
+    const char *strings;
+    size_t need;
+
+    if (fread(lenbuf, 1, 4, r->fp) != 4) {
+        return 0;
+    }
+    len = get32(lenbuf);
+    if (len < 4 * (HEADER_WORDS - 1)) {
+        return -1;
+    }
+
+    r->buf = grow(r->buf, &r->buf_cap, len, 1);
+    if (fread(r->buf, 1, len, r->fp) != len) {
+        return -1;
+    }
+
+    h[H_LENGTH] = len;
+    for (i = 1; i < HEADER_WORDS; i++) {
+        h[i] = get32(r->buf + 4 * (i - 1));
+    }
+
+    need = 4 * (HEADER_WORDS - 1) + (size_t)h[H_TRACKS] * 4 * TRACK_WORDS +
+        (size_t)h[H_ARTISTS] * 4 * ARTIST_WORDS + h[H_STRINGS];
+    if (need != len || (h[H_STRINGS] && r->buf[len - 1] != '\0')) {
+        return -1;
+    }
+
+    p = r->buf + 4 * (HEADER_WORDS - 1);
+    strings = (const char *)r->buf + len - h[H_STRINGS];
+
+    r->pl.flags = h[H_FLAGS];
+    r->pl.total_tracks = h[H_TOTAL];
+    r->pl.num_tracks = h[H_TRACKS];
+    r->pl.num_artists = h[H_ARTISTS];
+    r->pl.uri = string_at(strings, h[H_STRINGS], h[H_URI]);
+    r->pl.name = string_at(strings, h[H_STRINGS], h[H_NAME]);
+    r->pl.owner = string_at(strings, h[H_STRINGS], h[H_OWNER]);
+    r->pl.description = string_at(strings, h[H_STRINGS], h[H_DESCRIPTION]);
+
+    r->pl.tracks = grow(r->pl.tracks, &r->tracks_cap, h[H_TRACKS] + 1, sizeof(struct raw_track));
+    for (i = 0; i < h[H_TRACKS]; i++, p += 4 * TRACK_WORDS) {
+        struct raw_track *t = &r->pl.tracks[i];
+        t->index = get32(p + 0);
+        t->duration = get32(p + 4);
+        t->epoch = (int32_t)get32(p + 8);
+        t->creator = string_at(strings, h[H_STRINGS], get32(p + 12));
+        t->uri = string_at(strings, h[H_STRINGS], get32(p + 16));
+        t->name = string_at(strings, h[H_STRINGS], get32(p + 20));
+        t->album_uri = string_at(strings, h[H_STRINGS], get32(p + 24));
+        t->album_name = string_at(strings, h[H_STRINGS], get32(p + 28));
+        t->first_artist = get32(p + 32);
+        t->num_artists = get32(p + 36);
+        if ((uint64_t)t->first_artist + t->num_artists > h[H_ARTISTS]) {
+            return -1;
+        }
+    }
+
+    r->pl.artists = grow(r->pl.artists, &r->artists_cap, h[H_ARTISTS] + 1, sizeof(struct raw_artist));
+    for (i = 0; i < h[H_ARTISTS]; i++, p += 4 * ARTIST_WORDS) {
+        r->pl.artists[i].uri = string_at(strings, h[H_STRINGS], get32(p + 0));
+        r->pl.artists[i].name = string_at(strings, h[H_STRINGS], get32(p + 4));
+    }
+
+    *pl = &r->pl;
+    return 1;
+}
+
+void
+raw_reader_free(struct raw_reader *r)
+{
+    free(r->buf);
+    free(r->pl.tracks);
+    free(r->pl.artists);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,119 @@
+/*
+ * Binary raw dump format.
+ *
+ * The stream starts with RAW_MAGIC and is followed by one length-prefixed
+ * record per playlist.  All integers are 32 bit little endian.
+ *
+ *   u32 length          bytes in the record after this field
+ *   u32 flags
+ *   u32 total_tracks    sp_playlist_num_tracks() at dump time
+ *   u32 num_tracks      track records that follow
+ *   u32 num_artists     artist records that follow the tracks
+ *   u32 strings_len     bytes in the string section
+ *   u32 uri, name, owner, description
+ *   num_tracks x { u32 index, duration, epoch,
+ *                  creator, uri, name, album_uri, album_name,
+ *                  first_artist, num_artists }
+ *   num_artists x { u32 uri, name }
+ *   strings_len bytes of NUL terminated strings
+ *
+ * Strings are offsets into the record's string section, RAW_NONE when
+ * absent.  Identical strings within a record are stored once.
+ *
+ * Flags: RAW_INCOMPLETE is set when some tracks never loaded and were left
+ * out, so num_tracks is less than total_tracks.
+ */
+
+#ifndef PL_RAW_H
+#define PL_RAW_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RAW_MAGIC "\x89PXRAW\r\n"
+#define RAW_MAGIC_LEN 8
+#define RAW_NONE 0xffffffffU
+
+#define RAW_INCOMPLETE 0x1
+
+struct raw_track {
+    uint32_t index;
+    uint32_t duration;
+    int32_t epoch;
+    const char *creator;
+    const char *uri;
+    const char *name;
+    const char *album_uri;
+    const char *album_name;
+    uint32_t first_artist;
+    uint32_t num_artists;
+};
+
+struct raw_artist {
+    const char *uri;
+    const char *name;
+};
+
+struct raw_playlist {
+    uint32_t flags;
+    uint32_t total_tracks;
+    uint32_t num_tracks;
+    uint32_t num_artists;
+    const char *uri;
+    const char *name;
+    const char *owner;
+    const char *description;
+    struct raw_track *tracks;
+    struct raw_artist *artists;
+};
+
+/* --- Writing --- */
+
+struct raw_string_slot {
+    uint32_t hash;
+    uint32_t offset;
+};
+
+struct raw_builder {
+    unsigned char *tracks;
+    size_t tracks_len, tracks_cap;
+    unsigned char *artists;
+    size_t artists_len, artists_cap;
+    char *strings;
+    size_t strings_len, strings_cap;
+    struct raw_string_slot *slots;
+    size_t slots_used, slots_cap;
+    unsigned char *out;
+    size_t out_cap;
+    uint32_t header[10];
+    uint32_t num_tracks;
+    uint32_t num_artists;
+};
+
+void raw_builder_init(struct raw_builder *b);
+void raw_begin(struct raw_builder *b, const char *uri, int total_tracks,
+               const char *name, const char *owner, const char *description);
+void raw_track(struct raw_builder *b, int index, const char *creator,
+               const char *uri, const char *name, int duration, int epoch,
+               const char *album_uri, const char *album_name);
+void raw_artist(struct raw_builder *b, const char *uri, const char *name);
+void raw_flags(struct raw_builder *b, uint32_t flags);
+size_t raw_finish(struct raw_builder *b, const unsigned char **record);
+
+/* --- Reading --- */
+
+struct raw_reader {
+    FILE *fp;
+    unsigned char *buf;
+    size_t buf_cap;
+    struct raw_playlist pl;
+    size_t tracks_cap;
+    size_t artists_cap;
+};
+
+int raw_is_binary(FILE *fp);
+int raw_reader_init(struct raw_reader *r, FILE *fp);
+int raw_read_playlist(struct raw_reader *r, struct raw_playlist **pl);
+void raw_reader_free(struct raw_reader *r);
+
+#endif
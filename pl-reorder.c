@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "pl-buf.h"
+#include "pl-reorder.h"
+#include "pl-writer.h"
+
+/*
+ * Put finished playlists back into container order before they reach the
+ * writer, so the dump (and the xspf files numbered from it) comes out the
+ * same from run to run however the loads race.
+ *
+ * Each container index has a slot.  A playlist that finishes ahead of
+ * its turn is held in its slot; whenever the next index in line is
+ * resolved, it and every resolved slot after it are handed to the writer.
+ * Held output is bounded by bytes: past the limit a playlist's output is
+ * spilled to an unlinked temporary file and read back when its turn
+ * comes, so one slow playlist can't pin the rest of the run in memory.
+ *
+ * Without reorder_init everything passes straight through.  Main thread
+ * only.
+ */
+
+enum { WAITING, HELD, SPILLED, SKIPPED };
+
+struct slot {
+    int state;
+    struct pl_buf *buf;     /* HELD */
+    off_t off;              /* SPILLED: where in the spill file, and how much */
+    size_t len;
+    char *tag;
+};
+
+/* which container indexes a playlist was expected at, earliest first */
+struct expected {
+    sp_playlist *pl;
+    int index;
+    struct expected *next;
+};
+
+static int g_enabled;
+static size_t g_max_bytes;
+
+static struct slot *g_slots;
+static int g_nslots, g_next;
+
+static struct expected **g_buckets;
+static size_t g_nbuckets, g_count;
+
+static FILE *g_spill;
+static off_t g_spill_end;
+
+static size_t g_held_bytes, g_peak_bytes;
+static int g_held, g_peak_held;
+static unsigned long g_reordered, g_spilled;
+static unsigned long long g_spilled_bytes;
+
+void
+reorder_init(size_t max_bytes)
+{
+    g_enabled = 1;
+    g_max_bytes = max_bytes;
+}
+
+static size_t
+bucket(sp_playlist *pl, size_t n)
+{
+    uintptr_t x = (uintptr_t)pl;
+    x ^= x >> 17;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (x >> 20) & (n - 1);
+}
+
+static void
+rehash(void)
+{
+    size_t n = g_nbuckets ? 2 * g_nbuckets : 256, i;
+    struct expected **b = calloc(n, sizeof(*b));
+
+    if (b == NULL) {
+        fprintf(stderr, "pl-reorder: out of memory\n");
+        exit(1);
+    }
+
+    /* walk each chain backwards onto the new heads, keeping index order */
+    for (i = 0; i < g_nbuckets; i++) {
+        struct expected *x = g_buckets[i], *next, *rev = NULL;
+        for (; x; x = next) {
+            next = x->next;
+            x->next = rev;
+            rev = x;
+        }
+        for (; rev; rev = next) {
+            size_t k = bucket(rev->pl, n);
+            next = rev->next;
+            rev->next = b[k];
+            b[k] = rev;
+        }
+    }
+    free(g_buckets);
+    g_buckets = b;
+    g_nbuckets = n;
+}
+
+static struct slot *
+slot(int index)
+{
+    if (index >= g_nslots) {
+        int n = g_nslots ? 2 * g_nslots : 1024;
+        while (n <= index) {
+            n *= 2;
+        }
+        g_slots = realloc(g_slots, n * sizeof(*g_slots));
+        if (g_slots == NULL) {
+            fprintf(stderr, "pl-reorder: out of memory\n");
+            exit(1);
+        }
+        memset(g_slots + g_nslots, 0, (n - g_nslots) * sizeof(*g_slots));
+        g_nslots = n;
+    }
+    return &g_slots[index];
+}
+
+/* pl sits at container index, and will be submitted or skipped later */
+void
+reorder_expect(sp_playlist *pl, int index)
+{
+    struct expected *x, **xp;
+
+    if (!g_enabled) {
+        return;
+    }
+    if (g_count >= g_nbuckets) {
+        rehash();
+    }
+    x = calloc(1, sizeof(*x));
+    if (x == NULL) {
+        fprintf(stderr, "pl-reorder: out of memory\n");
+        exit(1);
+    }
+    x->pl = pl;
+    x->index = index;
+    for (xp = &g_buckets[bucket(pl, g_nbuckets)]; *xp; xp = &(*xp)->next) {
+    }
+    *xp = x;
+    g_count++;
+    slot(index);
+}
+
+/* the earliest index pl is still expected at, or -1 */
+static int
+take_index(sp_playlist *pl)
+{
+    struct expected **xp, *x;
+    int index;
+
+    if (g_nbuckets == 0) {
+        return -1;
+    }
+    for (xp = &g_buckets[bucket(pl, g_nbuckets)]; (x = *xp); xp = &x->next) {
+        if (x->pl == pl) {
+            index = x->index;
+            *xp = x->next;
+            free(x);
+            g_count--;
+            return index;
+        }
+    }
+    return -1;
+}
+
+static void
+unspill(struct slot *s)
+{
+    struct pl_buf *buf = writer_buffer();
+    size_t got = 0;
+
+    if (buf->cap < s->len) {
+        buf_free(buf);
+        buf_init(buf, s->len);
+    }
+    while (got < s->len) {
+        ssize_t n = pread(fileno(g_spill), buf->data + got, s->len - got, s->off + got);
+        if (n <= 0) {
+            fprintf(stderr, "reorder spill: %s\n", n < 0 ? strerror(errno) : "short read");
+            exit(1);
+        }
+        got += n;
+    }
+    buf->len = s->len;
+    s->buf = buf;
+}
+
+/* hand every resolved slot from the head of the line to the writer */
+static void
+drain(void)
+{
+    while (g_next < g_nslots && g_slots[g_next].state != WAITING) {
+        struct slot *s = &g_slots[g_next++];
+
+        if (s->state == SPILLED) {
+            unspill(s);
+        }
+        if (s->state == HELD) {
+            g_held_bytes -= s->buf->len;
+            g_held--;
+        }
+        if (s->buf) {
+            if (s->tag) {
+                writer_tag(s->buf, s->tag);
+            }
+            writer_submit(s->buf);
+        }
+        free(s->tag);
+        memset(s, 0, sizeof(*s));
+        s->state = SKIPPED;
+    }
+}
+
+/* container index won't produce any output */
+void
+reorder_skip(int index)
+{
+    if (!g_enabled) {
+        return;
+    }
+    slot(index)->state = SKIPPED;
+    drain();
+}
+
+/* pl won't produce any output at the index it was expected at */
+void
+reorder_skip_playlist(sp_playlist *pl)
+{
+    int index;
+
+    if (g_enabled && (index = take_index(pl)) >= 0) {
+        reorder_skip(index);
+    }
+}
+
+static void
+spill(struct slot *s, struct pl_buf *buf)
+{
+    if (g_spill == NULL && (g_spill = tmpfile()) == NULL) {
+        fprintf(stderr, "reorder spill: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (buf_write(buf, fileno(g_spill)) != 0) {
+        fprintf(stderr, "reorder spill: %s\n", strerror(errno));
+        exit(1);
+    }
+    s->state = SPILLED;
+    s->off = g_spill_end;
+    s->len = buf->len;
+    g_spill_end += buf->len;
+    g_spilled++;
+    g_spilled_bytes += buf->len;
+    writer_release(buf);
+}
+
+/*
+ * The finished output for pl, tagged with tag once written (see
+ * writer_tag).  Written now if it's pl's turn, otherwise held or spilled.
+ */
+void
+reorder_submit(sp_playlist *pl, struct pl_buf *buf, const char *tag)
+{
+    struct slot *s;
+    int index;
+
+    if (!g_enabled || (index = take_index(pl)) < 0) {
+        if (tag) {
+            writer_tag(buf, tag);
+        }
+        writer_submit(buf);
+        return;
+    }
+
+    s = slot(index);
+    s->tag = tag ? strdup(tag) : NULL;
+    if (index == g_next) {
+        s->state = HELD;
+        s->buf = buf;
+        g_held_bytes += buf->len;
+        g_held++;
+        drain();
+        return;
+    }
+
+    g_reordered++;
+    if (g_held_bytes + buf->len > g_max_bytes) {
+        spill(s, buf);
+        return;
+    }
+    s->state = HELD;
+    s->buf = buf;
+    g_held_bytes += buf->len;
+    if (g_held_bytes > g_peak_bytes) {
+        g_peak_bytes = g_held_bytes;
+    }
+    if (++g_held > g_peak_held) {
+        g_peak_held = g_held;
+    }
+}
+
+/* write out whatever is still held, in order, skipping the gaps */
+void
+reorder_flush(void)
+{
+    int i, waiting = 0;
+
+    for (i = g_next; i < g_nslots; i++) {
+        if (g_slots[i].state == WAITING) {
+            g_slots[i].state = SKIPPED;
+            waiting++;
+        }
+    }
+    if (g_enabled && g_count) {
+        fprintf(stderr, "RO %d playlists never turned up, writing the rest\n", waiting);
+    }
+    drain();
+    if (g_spill) {
+        fclose(g_spill);
+        g_spill = NULL;
+    }
+}
+
+void
+print_reorder(char *prefix)
+{
+    if (!g_enabled) {
+        return;
+    }
+    fprintf(stderr, "%s reordered=%lu peak_held=%d peak_bytes=%zu/%zu spilled=%lu spilled_bytes=%llu\n",
+            prefix, g_reordered, g_peak_held, g_peak_bytes, g_max_bytes,
+            g_spilled, g_spilled_bytes);
+}
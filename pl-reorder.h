@@ -0,0 +1,7 @@
+void reorder_init(size_t max_bytes);
+void reorder_expect(sp_playlist *, int index);
+void reorder_skip(int index);
+void reorder_skip_playlist(sp_playlist *);
+void reorder_submit(sp_playlist *, struct pl_buf *, const char *tag);
+void reorder_flush(void);
+void print_reorder(char *);
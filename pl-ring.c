@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "pl-ring.h"
+
+/*
+ * Bounded multi-producer, single-consumer ring of events for the thread
+ * that owns the playlist queues.
+ *
+ * Any thread may ring_push; only the owner may ring_pop.  Each cell
+ * carries a sequence number (after Vyukov's bounded queue): a producer
+ * claims position p with a compare-and-swap on the tail when the cell's
+ * sequence is p, fills it, and publishes it by storing p + 1.  The
+ * consumer takes the cell once it sees p + 1 and hands it back for the
+ * next lap by storing p + size.  No locks, so a push is safe from inside
+ * a libspotify callback and never waits on the consumer.
+ *
+ * A full ring drops the event and sets a flag instead of blocking, since
+ * the owner may be the one pushing.  The owner checks ring_overflowed()
+ * and falls back to rescanning everything, so dropped events cost time but
+ * never lose a playlist.
+ */
+
+struct cell {
+    unsigned long seq;
+    struct ring_event ev;
+};
+
+static struct cell *g_cells;
+static unsigned long g_mask;
+static unsigned long g_tail;        /* next position to claim, producers */
+static unsigned long g_head;        /* next position to take, consumer only */
+static int g_overflow;
+static unsigned long g_pushed, g_dropped, g_peak;
+
+void
+ring_init(unsigned size)
+{
+    unsigned long n = 1, i;
+
+    while (n < size) {
+        n <<= 1;
+    }
+    g_cells = calloc(n, sizeof(*g_cells));
+    if (g_cells == NULL) {
+        fprintf(stderr, "pl-ring: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        g_cells[i].seq = i;
+    }
+    g_mask = n - 1;
+}
+
+/* returns 0, or -1 if the ring was full and the event was dropped */
+int
+ring_push(int type, sp_playlist *pl)
+{
+    unsigned long pos = __atomic_load_n(&g_tail, __ATOMIC_RELAXED);
+    struct cell *c;
+
+    for (;;) {
+        long diff;
+
+        c = &g_cells[pos & g_mask];
+        diff = (long)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            /* lost the race, pos now holds the current tail */
+        } else if (diff < 0) {
+            __atomic_store_n(&g_overflow, 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&g_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    c->ev.type = type;
+    c->ev.pl = pl;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_pushed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* consumer only: returns 1 and fills *ev, or 0 if the ring is empty */
+int
+ring_pop(struct ring_event *ev)
+{
+    struct cell *c = &g_cells[g_head & g_mask];
+    unsigned long depth;
+
+    if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != g_head + 1) {
+        return 0;
+    }
+    *ev = c->ev;
+    __atomic_store_n(&c->seq, g_head + g_mask + 1, __ATOMIC_RELEASE);
+    g_head++;
+
+    depth = __atomic_load_n(&g_tail, __ATOMIC_RELAXED) - g_head + 1;
+    if (depth > g_peak) {
+        g_peak = depth;
+    }
+    return 1;
+}
+
+/* consumer only: whether events were dropped since the last call */
+int
+ring_overflowed(void)
+{
+    return __atomic_exchange_n(&g_overflow, 0, __ATOMIC_ACQUIRE);
+}
+
+void
+print_ring(char *prefix)
+{
+    fprintf(stderr, "%s size=%lu pushed=%lu dropped=%lu peak=%lu\n", prefix, g_mask + 1,
+            __atomic_load_n(&g_pushed, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_dropped, __ATOMIC_RELAXED), g_peak);
+}
@@ -0,0 +1,11 @@
+/* something the main thread should look at, see pl-ring.c */
+struct ring_event {
+    int type;
+    sp_playlist *pl;
+};
+
+void ring_init(unsigned size);
+int ring_push(int type, sp_playlist *pl);
+int ring_pop(struct ring_event *);
+int ring_overflowed(void);
+void print_ring(char *);
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libspotify/api.h>
+
+#include "pl-sched.h"
+
+/*
+ * Policies for ordering the pending queue.
+ *
+ * The pending queue is a priority queue on a key computed once, when a
+ * playlist is queued; lower keys are fetched first and equal keys keep
+ * container order.  Policies:
+ *
+ *   fifo      container order
+ *   unloaded  playlists libspotify hasn't loaded yet first, then container
+ *             order (what px always did)
+ *   shortest  fewest tracks first, so one huge playlist doesn't hold a
+ *             window slot while hundreds of small ones wait; unloaded
+ *             playlists count as empty
+ *   owner     round robin between owners: everyone's first playlist, then
+ *             everyone's second, ...; a playlist whose owner isn't known
+ *             yet counts as its own owner, so it goes in the first round
+ */
+
+enum { FIFO, UNLOADED, SHORTEST, OWNER };
+
+static const char *g_names[] = { "fifo", "unloaded", "shortest", "owner" };
+static int g_policy = UNLOADED;
+
+/* playlists queued so far per owner, for round robin */
+struct owner_count {
+    char *name;
+    long count;
+    struct owner_count *next;
+};
+
+#define OWNER_BUCKETS 1024
+static struct owner_count *g_owners[OWNER_BUCKETS];
+
+static double g_started, g_first_output, g_last_output, g_sum_output;
+static long g_outputs;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* select a policy by name, returning -1 if there is no such policy */
+int
+sched_policy(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(g_names) / sizeof(g_names[0]); i++) {
+        if (strcmp(name, g_names[i]) == 0) {
+            g_policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static long
+owner_turn(sp_playlist *pl)
+{
+    sp_user *user = sp_playlist_owner(pl);
+    const char *name = user ? sp_user_canonical_name(user) : NULL;
+    uint32_t h = 2166136261U;
+    const char *s;
+    struct owner_count *o;
+
+    /* unloaded playlists would otherwise all queue up behind one "" owner */
+    if (!sp_playlist_is_loaded(pl) || name == NULL || *name == '\0') {
+        return 0;
+    }
+
+    for (s = name; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619U;
+    }
+    for (o = g_owners[h % OWNER_BUCKETS]; o; o = o->next) {
+        if (strcmp(o->name, name) == 0) {
+            return o->count++;
+        }
+    }
+    o = malloc(sizeof(*o));
+    if (o == NULL || (o->name = strdup(name)) == NULL) {
+        fprintf(stderr, "pl-sched: out of memory\n");
+        exit(1);
+    }
+    o->count = 1;
+    o->next = g_owners[h % OWNER_BUCKETS];
+    g_owners[h % OWNER_BUCKETS] = o;
+    return 0;
+}
+
+/* priority of a playlist about to be queued, lowest first */
+long
+sched_key(sp_playlist *pl)
+{
+    switch (g_policy) {
+    case UNLOADED:
+        return sp_playlist_is_loaded(pl) && *sp_playlist_name(pl) ? 1 : 0;
+    case SHORTEST:
+        return sp_playlist_num_tracks(pl);
+    case OWNER:
+        return owner_turn(pl);
+    default:
+        return 0;
+    }
+}
+
+/* mark the start of the schedule, when the pending queue is filled */
+void
+sched_started(void)
+{
+    g_started = now();
+}
+
+/* note that a playlist has been written out */
+void
+sched_output(void)
+{
+    g_last_output = now();
+    g_sum_output += g_last_output - g_started;
+    g_outputs++;
+    if (g_first_output == 0) {
+        g_first_output = g_last_output;
+    }
+}
+
+void
+print_sched(char *prefix)
+{
+    fprintf(stderr, "%s policy=%s first_output_s=%.3f mean_output_s=%.3f makespan_s=%.3f\n",
+            prefix, g_names[g_policy],
+            g_first_output ? g_first_output - g_started : 0,
+            g_outputs ? g_sum_output / g_outputs : 0,
+            g_last_output ? g_last_output - g_started : 0);
+}
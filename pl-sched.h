@@ -0,0 +1,5 @@
+int sched_policy(const char *);
+long sched_key(sp_playlist *);
+void sched_started(void);
+void sched_output(void);
+void print_sched(char *);
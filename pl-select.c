@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "pl-select.h"
+
+/*
+ * Which playlists -l asked for.  Each -l is a playlist URI, @file for a
+ * file of URIs (one per line, # starts a comment), or a shell glob
+ * matched against playlist names.  URIs can be loaded straight away; only
+ * globs need the rootlist.
+ */
+
+static char **g_uris;
+static int g_num_uris, g_max_uris;
+static char **g_globs;
+static int g_num_globs, g_max_globs;
+
+/* playlists created from g_uris, so the rootlist doesn't queue them again */
+static sp_playlist **g_created;
+static int g_num_created, g_max_created;
+
+static void *
+grow(void *p, int *cap, int need, size_t size)
+{
+    if (need > *cap) {
+        *cap = *cap ? 2 * *cap : 16;
+        p = realloc(p, *cap * size);
+        if (p == NULL) {
+            fprintf(stderr, "pl-select: out of memory\n");
+            exit(1);
+        }
+    }
+    return p;
+}
+
+static char *
+xstrdup(const char *s)
+{
+    char *p = strdup(s);
+
+    if (p == NULL) {
+        fprintf(stderr, "pl-select: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void
+add_uri(const char *uri)
+{
+    g_uris = grow(g_uris, &g_max_uris, g_num_uris + 1, sizeof(*g_uris));
+    g_uris[g_num_uris++] = xstrdup(uri);
+}
+
+static int
+add_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[1024];
+
+    if (fp == NULL) {
+        fprintf(stderr, "-l %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        char *s = line, *e;
+
+        while (*s == ' ' || *s == '\t') {
+            s++;
+        }
+        for (e = s + strlen(s); e > s && strchr(" \t\r\n", e[-1]); e--) {
+        }
+        *e = '\0';
+        if (*s == '\0' || *s == '#') {
+            continue;
+        }
+        if (strncmp(s, "spotify:", 8) != 0) {
+            fprintf(stderr, "-l %s: not a spotify URI: %s\n", path, s);
+            continue;
+        }
+        add_uri(s);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* one -l argument; returns -1 if it names a file that can't be read */
+int
+select_add(const char *spec)
+{
+    if (strncmp(spec, "spotify:", 8) == 0) {
+        add_uri(spec);
+    } else if (spec[0] == '@') {
+        return add_file(spec + 1);
+    } else {
+        g_globs = grow(g_globs, &g_max_globs, g_num_globs + 1, sizeof(*g_globs));
+        g_globs[g_num_globs++] = xstrdup(spec);
+    }
+    return 0;
+}
+
+int
+select_active(void)
+{
+    return g_num_uris + g_num_globs != 0;
+}
+
+int
+select_has_globs(void)
+{
+    return g_num_globs != 0;
+}
+
+int
+select_num_uris(void)
+{
+    return g_num_uris;
+}
+
+const char *
+select_uri(int i)
+{
+    return g_uris[i];
+}
+
+/* whether a playlist name matches one of the globs */
+int
+select_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < g_num_globs; i++) {
+        if (fnmatch(g_globs[i], name ? name : "", 0) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+select_created(sp_playlist *pl)
+{
+    g_created = grow(g_created, &g_max_created, g_num_created + 1, sizeof(*g_created));
+    g_created[g_num_created++] = pl;
+}
+
+int
+select_is_created(sp_playlist *pl)
+{
+    int i;
+
+    for (i = 0; i < g_num_created; i++) {
+        if (g_created[i] == pl) {
+            return 1;
+        }
+    }
+    return 0;
+}
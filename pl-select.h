@@ -0,0 +1,8 @@
+int select_add(const char *spec);
+int select_active(void);
+int select_has_globs(void);
+int select_num_uris(void);
+const char *select_uri(int i);
+int select_name(const char *name);
+void select_created(sp_playlist *);
+int select_is_created(sp_playlist *);
@@ -0,0 +1,532 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pl-buf.h"
+#include "pl-snapshot.h"
+
+/*
+ * Snapshot of the previous run, for incremental dumps.
+ *
+ * For every playlist written, the snapshot keeps a fingerprint (URI, track
+ * count and a hash of the name, owner, description and the ordered track
+ * URIs and add times) next to the
+ * exact bytes that were written for it.  On the next run a playlist whose
+ * URI and track count match is hashed again from the container, which
+ * needs no track metadata, and if the hash matches too its old bytes are
+ * carried over instead of loading it.
+ *
+ *   "PXSNAP2\n" u32 format
+ *   records of { u32 num_tracks, u64 hash, u32 uri_len, u32 data_len,
+ *                uri_len bytes of URI, data_len bytes of output }
+ *
+ * All integers are little endian.  Loading stops at the first record
+ * that runs past the end of the file.  PXSNAP1 files hold output keyed by
+ * the old %p playlist refs, which no longer match anything, so they are
+ * not carried over from.  The new snapshot is written next to
+ * the old one and renamed over it only when the run completes, so an
+ * interrupted run leaves the previous snapshot intact.
+ *
+ * --watch reopens the snapshot to compact its journal into it: the
+ * playlists edited since are added afresh, snapshot_keep_rest copies over
+ * the rest, and the result is committed the same way.  Each committed
+ * snapshot is identified by a hash of its bytes, which the journal
+ * records so that it is never applied to the wrong snapshot.
+ */
+
+#define SNAP_MAGIC "PXSNAP2\n"
+#define SNAP_MAGIC_OLD "PXSNAP1\n"
+#define SNAP_MAGIC_LEN 8
+#define SNAP_HEADER_LEN 20
+
+struct snap_entry {
+    char *uri;
+    int num_tracks;
+    uint64_t hash;
+    off_t offset;           /* of the data in the old snapshot */
+    uint32_t len;
+    struct snap_entry *next;
+};
+
+struct snap_table {
+    struct snap_entry **buckets;
+    size_t nbuckets, count;
+};
+
+static struct snap_table g_old;         /* previous run, read-only */
+static struct snap_table g_expected;    /* fingerprints waiting for the writer */
+static struct snap_table g_added;       /* written to the new snapshot */
+static pthread_mutex_t g_snap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int g_old_fd = -1;
+static int g_new_fd = -1;
+static char *g_path, *g_tmp;
+static int g_format;
+static unsigned long g_carried, g_written, g_kept;
+static uint64_t g_new_id, g_id;         /* of the snapshot being written, last committed */
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+fnv1a(uint64_t h, const void *p, size_t len)
+{
+    const unsigned char *s = p;
+    while (len--) {
+        h = (h ^ *s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void *
+xcalloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+
+    if (p == NULL) {
+        fprintf(stderr, "pl-snapshot: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static char *
+xstrdup(const char *s)
+{
+    char *p = strdup(s);
+
+    if (p == NULL) {
+        fprintf(stderr, "pl-snapshot: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* fold a playlist's name, owner or description into its hash, starting from 0 */
+uint64_t
+fingerprint_text(uint64_t h, const char *text)
+{
+    if (h == 0) {
+        h = 14695981039346656037ULL;
+    }
+    return fnv1a(h, text ? text : "", text ? strlen(text) + 1 : 1);
+}
+
+/* fold one track into a playlist hash, starting from 0 */
+uint64_t
+fingerprint_add(uint64_t h, const char *track_uri, int added)
+{
+    unsigned char when[4];
+
+    if (h == 0) {
+        h = 14695981039346656037ULL;
+    }
+    put32(when, added);
+    h = fnv1a(h, track_uri, strlen(track_uri) + 1);
+    return fnv1a(h, when, 4);
+}
+
+static struct snap_entry *
+find(struct snap_table *t, const char *uri, int unlink)
+{
+    struct snap_entry **pp;
+
+    if (t->nbuckets == 0) {
+        return NULL;
+    }
+    pp = &t->buckets[fnv1a(14695981039346656037ULL, uri, strlen(uri)) & (t->nbuckets - 1)];
+    for (; *pp; pp = &(*pp)->next) {
+        if (strcmp((*pp)->uri, uri) == 0) {
+            struct snap_entry *e = *pp;
+            if (unlink) {
+                *pp = e->next;
+                t->count--;
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+clear(struct snap_table *t)
+{
+    size_t i;
+
+    for (i = 0; i < t->nbuckets; i++) {
+        struct snap_entry *e = t->buckets[i], *next;
+        for (; e; e = next) {
+            next = e->next;
+            free(e->uri);
+            free(e);
+        }
+    }
+    free(t->buckets);
+    memset(t, 0, sizeof(*t));
+}
+
+static void
+insert(struct snap_table *t, struct snap_entry *e)
+{
+    size_t k;
+
+    if (t->count >= t->nbuckets) {
+        size_t n = t->nbuckets ? 2 * t->nbuckets : 1024, i;
+        struct snap_entry **b = xcalloc(n, sizeof(*b));
+
+        for (i = 0; i < t->nbuckets; i++) {
+            struct snap_entry *p = t->buckets[i], *next;
+            for (; p; p = next) {
+                next = p->next;
+                k = fnv1a(14695981039346656037ULL, p->uri, strlen(p->uri)) & (n - 1);
+                p->next = b[k];
+                b[k] = p;
+            }
+        }
+        free(t->buckets);
+        t->buckets = b;
+        t->nbuckets = n;
+    }
+    k = fnv1a(14695981039346656037ULL, e->uri, strlen(e->uri)) & (t->nbuckets - 1);
+    e->next = t->buckets[k];
+    t->buckets[k] = e;
+    t->count++;
+}
+
+/* index the previous snapshot; a missing or foreign one is just empty */
+static void
+load(const char *path, int format)
+{
+    unsigned char h[SNAP_HEADER_LEN];
+    off_t off = SNAP_MAGIC_LEN + 4;
+    char *uri = NULL;
+    size_t uri_cap = 0;
+    struct stat st;
+
+    g_old_fd = open(path, O_RDONLY);
+    if (g_old_fd < 0) {
+        return;
+    }
+    if (fstat(g_old_fd, &st) != 0) {
+        st.st_size = 0;
+    }
+    if (pread(g_old_fd, h, SNAP_MAGIC_LEN + 4, 0) != SNAP_MAGIC_LEN + 4) {
+        memset(h, 0, sizeof(h));
+    }
+    if (memcmp(h, SNAP_MAGIC_OLD, SNAP_MAGIC_LEN) == 0) {
+        fprintf(stderr, "SNAP %s was written by an older px with different playlist refs, "
+                "ignoring it; every playlist will be fetched again\n", path);
+        close(g_old_fd);
+        g_old_fd = -1;
+        return;
+    }
+    if (memcmp(h, SNAP_MAGIC, SNAP_MAGIC_LEN) != 0 || get32(h + SNAP_MAGIC_LEN) != format) {
+        fprintf(stderr, "SNAP %s is from another format, ignoring it\n", path);
+        close(g_old_fd);
+        g_old_fd = -1;
+        return;
+    }
+
+    while (pread(g_old_fd, h, SNAP_HEADER_LEN, off) == SNAP_HEADER_LEN) {
+        uint32_t uri_len = get32(h + 12), len = get32(h + 16);
+        struct snap_entry *e;
+
+        /* a truncated or garbled record; everything from here on is lost */
+        if (uri_len == 0 || uri_len > st.st_size - off - SNAP_HEADER_LEN ||
+            len > st.st_size - off - SNAP_HEADER_LEN - uri_len) {
+            fprintf(stderr, "SNAP %s: bad record at offset %lld, ignoring the rest\n",
+                    path, (long long)off);
+            break;
+        }
+        if (uri_len + 1 > uri_cap) {
+            uri_cap = uri_len + 1;
+            free(uri);
+            uri = xcalloc(1, uri_cap);
+        }
+        if (pread(g_old_fd, uri, uri_len, off + SNAP_HEADER_LEN) != uri_len) {
+            break;
+        }
+        uri[uri_len] = '\0';
+
+        e = xcalloc(1, sizeof(*e));
+        e->uri = xstrdup(uri);
+        e->num_tracks = get32(h);
+        e->hash = get32(h + 4) | (uint64_t)get32(h + 8) << 32;
+        e->offset = off + SNAP_HEADER_LEN + uri_len;
+        e->len = len;
+        insert(&g_old, e);
+        off = e->offset + len;
+    }
+    free(uri);
+    fprintf(stderr, "SNAP %zu playlists in %s\n", g_old.count, path);
+}
+
+/* write to the new snapshot, folding the bytes into its id */
+static int
+put(struct pl_buf *buf)
+{
+    g_new_id = fnv1a(g_new_id, buf->data, buf->len);
+    return buf_flush(buf, g_new_fd);
+}
+
+/**
+ * Load the snapshot at path, if there is one for the same output format,
+ * and start writing its replacement.
+ */
+int
+snapshot_open(const char *path, int format)
+{
+    unsigned char h[SNAP_MAGIC_LEN + 4];
+    size_t n = strlen(path) + 32;
+    struct pl_buf rec;
+
+    load(path, format);
+
+    g_path = xstrdup(path);
+    g_format = format;
+    g_tmp = xcalloc(1, n);
+    snprintf(g_tmp, n, "%s.%d.tmp", path, (int)getpid());
+    g_new_fd = open(g_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (g_new_fd < 0) {
+        fprintf(stderr, "snapshot %s: %s\n", g_tmp, strerror(errno));
+        return -1;
+    }
+    memcpy(h, SNAP_MAGIC, SNAP_MAGIC_LEN);
+    put32(h + SNAP_MAGIC_LEN, format);
+    g_new_id = 14695981039346656037ULL;
+    buf_init(&rec, sizeof(h));
+    buf_append(&rec, h, sizeof(h));
+    if (put(&rec) != 0) {
+        fprintf(stderr, "snapshot %s: %s\n", g_tmp, strerror(errno));
+        buf_free(&rec);
+        return -1;
+    }
+    buf_free(&rec);
+    return 0;
+}
+
+/* start over from the last committed snapshot, for compaction */
+int
+snapshot_reopen(void)
+{
+    char *path = g_path;
+    int r;
+
+    if (g_old_fd >= 0) {
+        close(g_old_fd);
+        g_old_fd = -1;
+    }
+    clear(&g_old);
+    clear(&g_expected);
+    clear(&g_added);
+    free(g_tmp);
+    g_carried = g_written = g_kept = 0;
+
+    r = snapshot_open(path, g_format);
+    free(path);
+    return r;
+}
+
+/* the cheap check: same URI and track count as last time */
+int
+snapshot_known(const char *uri, int num_tracks)
+{
+    struct snap_entry *e = find(&g_old, uri, 0);
+    return e && e->num_tracks == num_tracks;
+}
+
+int
+snapshot_unchanged(const char *uri, int num_tracks, uint64_t hash)
+{
+    struct snap_entry *e = find(&g_old, uri, 0);
+    return e && e->num_tracks == num_tracks && e->hash == hash;
+}
+
+static int
+read_old(const struct snap_entry *e, struct pl_buf *buf)
+{
+    char tmp[65536];
+    off_t off;
+    uint32_t left;
+
+    for (off = e->offset, left = e->len; left > 0; ) {
+        ssize_t r = pread(g_old_fd, tmp, left < sizeof(tmp) ? left : sizeof(tmp), off);
+        if (r <= 0) {
+            fprintf(stderr, "snapshot: short read for %s\n", e->uri);
+            return -1;
+        }
+        buf_append(buf, tmp, r);
+        off += r;
+        left -= r;
+    }
+    return 0;
+}
+
+/* append the previous run's output for uri to buf */
+int
+snapshot_carry(const char *uri, struct pl_buf *buf)
+{
+    struct snap_entry *e = find(&g_old, uri, 0);
+
+    if (e == NULL || read_old(e, buf) != 0) {
+        return -1;
+    }
+    g_carried++;
+    return 0;
+}
+
+/* the fingerprint of the output about to be submitted for uri */
+void
+snapshot_expect(const char *uri, int num_tracks, uint64_t hash)
+{
+    struct snap_entry *e;
+
+    if (g_new_fd < 0) {
+        return;
+    }
+    e = xcalloc(1, sizeof(*e));
+    e->uri = xstrdup(uri);
+    e->num_tracks = num_tracks;
+    e->hash = hash;
+    pthread_mutex_lock(&g_snap_mutex);
+    insert(&g_expected, e);
+    pthread_mutex_unlock(&g_snap_mutex);
+}
+
+static void
+record_header(struct pl_buf *rec, const struct snap_entry *e, uint32_t len)
+{
+    unsigned char h[SNAP_HEADER_LEN];
+
+    put32(h, e->num_tracks);
+    put32(h + 4, e->hash);
+    put32(h + 8, e->hash >> 32);
+    put32(h + 12, strlen(e->uri));
+    put32(h + 16, len);
+    buf_append(rec, h, SNAP_HEADER_LEN);
+    buf_append(rec, e->uri, strlen(e->uri));
+}
+
+/* record output that has been written; called by the writer */
+void
+snapshot_add(const char *uri, const struct pl_buf *buf)
+{
+    struct snap_entry *e;
+    struct pl_buf rec;
+
+    if (g_new_fd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_snap_mutex);
+    e = find(&g_expected, uri, 1);
+    pthread_mutex_unlock(&g_snap_mutex);
+    if (e == NULL) {
+        return;
+    }
+
+    /* written as one record, so the snapshot never holds half of one */
+    buf_init(&rec, SNAP_HEADER_LEN + strlen(uri) + buf->len);
+    record_header(&rec, e, buf->len);
+    buf_append(&rec, buf->data, buf->len);
+    if (put(&rec) != 0) {
+        fprintf(stderr, "snapshot: %s\n", strerror(errno));
+    }
+    buf_free(&rec);
+    g_written++;
+
+    /* remembered so snapshot_keep_rest doesn't copy the old one too */
+    pthread_mutex_lock(&g_snap_mutex);
+    insert(&g_added, e);
+    pthread_mutex_unlock(&g_snap_mutex);
+}
+
+/* copy every old playlist not added since snapshot_open to the new snapshot */
+void
+snapshot_keep_rest(void)
+{
+    size_t i;
+
+    if (g_new_fd < 0) {
+        return;
+    }
+    for (i = 0; i < g_old.nbuckets; i++) {
+        struct snap_entry *e;
+
+        for (e = g_old.buckets[i]; e; e = e->next) {
+            struct pl_buf rec;
+
+            if (find(&g_added, e->uri, 0)) {
+                continue;
+            }
+            buf_init(&rec, SNAP_HEADER_LEN + strlen(e->uri) + e->len);
+            record_header(&rec, e, e->len);
+            if (read_old(e, &rec) == 0) {
+                if (put(&rec) != 0) {
+                    fprintf(stderr, "snapshot: %s\n", strerror(errno));
+                }
+                g_kept++;
+            }
+            buf_free(&rec);
+        }
+    }
+}
+
+/**
+ * Replace the old snapshot with the new one if commit, else discard it.
+ * Returns 0 if the new one was committed.
+ */
+int
+snapshot_close(int commit)
+{
+    int r = -1;
+
+    if (g_new_fd < 0) {
+        return -1;
+    }
+    if (commit && fsync(g_new_fd) == 0 && close(g_new_fd) == 0 &&
+        rename(g_tmp, g_path) == 0) {
+        fprintf(stderr, "SNAP saved %lu playlists to %s\n", g_written + g_kept, g_path);
+        g_id = g_new_id;
+        r = 0;
+    } else {
+        if (commit) {
+            fprintf(stderr, "snapshot %s: %s\n", g_path, strerror(errno));
+        }
+        close(g_new_fd);
+        unlink(g_tmp);
+    }
+    g_new_fd = -1;
+    return r;
+}
+
+/* the hash identifying the last snapshot committed, 0 if none */
+uint64_t
+snapshot_id(void)
+{
+    return g_id;
+}
+
+void
+print_snapshot(char *prefix)
+{
+    fprintf(stderr, "%s previous=%zu carried=%lu written=%lu kept=%lu\n", prefix, g_old.count,
+            g_carried, g_written, g_kept);
+}
@@ -0,0 +1,13 @@
+int snapshot_open(const char *path, int format);
+int snapshot_reopen(void);
+int snapshot_known(const char *uri, int num_tracks);
+int snapshot_unchanged(const char *uri, int num_tracks, uint64_t hash);
+int snapshot_carry(const char *uri, struct pl_buf *);
+void snapshot_expect(const char *uri, int num_tracks, uint64_t hash);
+void snapshot_add(const char *uri, const struct pl_buf *);
+void snapshot_keep_rest(void);
+int snapshot_close(int commit);
+uint64_t snapshot_id(void);
+void print_snapshot(char *);
+uint64_t fingerprint_text(uint64_t h, const char *text);
+uint64_t fingerprint_add(uint64_t h, const char *track_uri, int added);
@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* only needed for typedefs */
+#include <libspotify/api.h>
+
+#include "pl-buf.h"
+#include "pl-snapshot.h"
+#include "pl-watch.h"
+
+/*
+ * Journal of playlist edits, for --watch.
+ *
+ * Every playlist that goes into the snapshot stays subscribed, and once
+ * the dump is done px keeps the session open and appends each edit that
+ * libspotify reports to the journal as one line:
+ *
+ *   PXJOURNAL1 <snapshot id>
+ *   ADD <time> <playlist uri> <position> <track uri>...
+ *   REMOVE <time> <playlist uri> <index>...
+ *   MOVE <time> <playlist uri> <new position> <index>...
+ *   RESYNC <time> <playlist uri>
+ *
+ * Indices and positions are as they were just before the edit; moved
+ * tracks end up in front of the track that was at new position.  Applied
+ * in order to the snapshot named in the header, the lines give the
+ * playlists as they are now.  RESYNC means tracks were added to the
+ * playlist before libspotify could say what they were: its edits from
+ * there on aren't journalled, and it is only up to date again once a
+ * compaction has written it into the snapshot.
+ *
+ * Every --compact seconds the journal is folded into a
+ * fresh snapshot: each edited playlist whose tracks have all loaded is
+ * written out again and the rest are copied from the old snapshot.  Once
+ * that is committed the journal is rewritten, keeping only the lines of
+ * playlists that couldn't be written yet, and renamed over the old one.
+ * A crash between the two renames leaves a journal naming the previous
+ * snapshot, which a reader must then ignore.
+ *
+ * Lines are appended with one write each and synced at most every
+ * WATCH_SYNC_MS.  Edits that come in while the dump is still running are
+ * held in memory until its snapshot is committed.  Main thread only.
+ */
+
+#define WATCH_SYNC_MS 1000
+#define HEADER_FMT "PXJOURNAL1 %016llx\n"
+#define HEADER_LEN 28
+
+struct watched {
+    sp_playlist *pl;
+    char *uri;
+    struct pl_buf lines;    /* journalled since the snapshot */
+    int dirty;
+    int stale;              /* RESYNC journalled, edits since not */
+    struct watched *next;
+};
+
+static struct watched **g_buckets;
+static size_t g_nbuckets, g_count;
+
+static char *g_path, *g_tmp;
+static int g_fd = -1;
+static int g_compact_ms;
+static int g_unsynced;
+static double g_last_sync, g_last_compact;
+
+static unsigned long g_edits, g_compactions, g_compacted, g_deferred;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static size_t
+bucket(sp_playlist *pl, size_t n)
+{
+    uintptr_t x = (uintptr_t)pl;
+    x ^= x >> 17;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (x >> 20) & (n - 1);
+}
+
+static void
+rehash(void)
+{
+    size_t n = g_nbuckets ? 2 * g_nbuckets : 256, i;
+    struct watched **b = calloc(n, sizeof(*b));
+
+    if (b == NULL) {
+        fprintf(stderr, "pl-watch: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < g_nbuckets; i++) {
+        struct watched *w = g_buckets[i], *next;
+        for (; w; w = next) {
+            size_t k = bucket(w->pl, n);
+            next = w->next;
+            w->next = b[k];
+            b[k] = w;
+        }
+    }
+    free(g_buckets);
+    g_buckets = b;
+    g_nbuckets = n;
+}
+
+static struct watched *
+find(sp_playlist *pl)
+{
+    struct watched *w;
+
+    if (g_nbuckets == 0) {
+        return NULL;
+    }
+    for (w = g_buckets[bucket(pl, g_nbuckets)]; w; w = w->next) {
+        if (w->pl == pl) {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Write a new journal for the snapshot with the given id, holding the
+ * lines of every playlist still dirty, and rename it over the old one.
+ * Edits are appended to it from then on.
+ */
+static int
+rewrite(uint64_t id)
+{
+    char header[HEADER_LEN + 1];
+    struct watched *w;
+    struct pl_buf all;
+    size_t i;
+    int fd = open(g_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+    if (fd < 0) {
+        fprintf(stderr, "journal %s: %s\n", g_tmp, strerror(errno));
+        return -1;
+    }
+    snprintf(header, sizeof(header), HEADER_FMT, (unsigned long long)id);
+    buf_init(&all, 64 * 1024);
+    buf_append(&all, header, HEADER_LEN);
+    for (i = 0; i < g_nbuckets; i++) {
+        for (w = g_buckets[i]; w; w = w->next) {
+            if (w->dirty) {
+                buf_append(&all, w->lines.data, w->lines.len);
+            }
+        }
+    }
+    if (buf_flush(&all, fd) != 0 || fsync(fd) != 0 || rename(g_tmp, g_path) != 0) {
+        fprintf(stderr, "journal %s: %s\n", g_path, strerror(errno));
+        buf_free(&all);
+        close(fd);
+        unlink(g_tmp);
+        return -1;
+    }
+    buf_free(&all);
+    if (g_fd >= 0) {
+        close(g_fd);
+    }
+    g_fd = fd;
+    g_unsynced = 0;
+    g_last_sync = now_ms();
+    return 0;
+}
+
+int
+watch_open(const char *path, int compact_secs)
+{
+    size_t n = strlen(path) + 32;
+
+    g_path = strdup(path);
+    g_tmp = malloc(n);
+    if (g_path == NULL || g_tmp == NULL) {
+        fprintf(stderr, "pl-watch: out of memory\n");
+        exit(1);
+    }
+    snprintf(g_tmp, n, "%s.%d.tmp", path, (int)getpid());
+    g_compact_ms = compact_secs * 1000;
+    return 0;
+}
+
+/* journal edits to a playlist from now on; returns -1 if it already is */
+int
+watch_add(sp_playlist *pl, const char *uri)
+{
+    struct watched *w;
+    size_t k;
+
+    if (g_path == NULL || find(pl)) {
+        return -1;
+    }
+    if (g_count >= g_nbuckets) {
+        rehash();
+    }
+    w = calloc(1, sizeof(*w));
+    if (w == NULL || (w->uri = strdup(uri)) == NULL) {
+        fprintf(stderr, "pl-watch: out of memory\n");
+        exit(1);
+    }
+    w->pl = pl;
+    k = bucket(pl, g_nbuckets);
+    w->next = g_buckets[k];
+    g_buckets[k] = w;
+    g_count++;
+    return 0;
+}
+
+/**
+ * Append "<op> <time> <uri> <args>" for an edit to a watched playlist.
+ * Until watch_commit there is no journal file, and edits are only kept
+ * in memory to go into it.
+ */
+static void
+append(struct watched *w, const char *op, const char *args, size_t len)
+{
+    size_t start;
+
+    if (w->lines.cap == 0) {
+        buf_init(&w->lines, 256);
+    }
+    start = w->lines.len;
+    buf_printf(&w->lines, "%s %lld %s", op, (long long)time(NULL), w->uri);
+    if (len > 0) {
+        buf_append(&w->lines, " ", 1);
+        buf_append(&w->lines, args, len);
+    }
+    buf_append(&w->lines, "\n", 1);
+
+    if (g_fd >= 0) {
+        if (write(g_fd, w->lines.data + start, w->lines.len - start) !=
+            (ssize_t)(w->lines.len - start)) {
+            fprintf(stderr, "journal %s: %s\n", g_path, strerror(errno));
+        }
+        g_unsynced = 1;
+    }
+}
+
+/* journal an edit to a watched playlist, see append */
+void
+watch_record(sp_playlist *pl, const char *op, const char *args, size_t len)
+{
+    struct watched *w = find(pl);
+
+    if (w == NULL) {
+        return;
+    }
+    if (!w->stale) {
+        append(w, op, args, len);
+    }
+    w->dirty = 1;
+    g_edits++;
+}
+
+/**
+ * An edit to a watched playlist that can't be journalled, such as tracks
+ * added that have no link yet.  The playlist stays dirty, without any
+ * more journal lines, until a compaction manages to save it.
+ */
+void
+watch_unresolved(sp_playlist *pl)
+{
+    struct watched *w = find(pl);
+
+    if (w == NULL) {
+        return;
+    }
+    if (!w->stale) {
+        append(w, "RESYNC", NULL, 0);
+        w->stale = 1;
+    }
+    w->dirty = 1;
+    g_edits++;
+}
+
+/* start the journal for the snapshot the dump just committed */
+int
+watch_commit(uint64_t snapshot_id)
+{
+    g_last_compact = now_ms();
+    return rewrite(snapshot_id);
+}
+
+/* fold the journal into a new snapshot; see the comment at the top */
+static void
+compact(int (*save)(sp_playlist *, const char *))
+{
+    struct watched *w;
+    size_t i, dirty = 0, saved = 0;
+    int committed;
+
+    for (i = 0; i < g_nbuckets; i++) {
+        for (w = g_buckets[i]; w; w = w->next) {
+            dirty += w->dirty;
+        }
+    }
+    if (dirty == 0 || snapshot_reopen() != 0) {
+        return;
+    }
+
+    for (i = 0; i < g_nbuckets; i++) {
+        for (w = g_buckets[i]; w; w = w->next) {
+            if (w->dirty && save(w->pl, w->uri)) {
+                w->dirty = -1; /* until the snapshot is committed */
+                saved++;
+            }
+        }
+    }
+    snapshot_keep_rest();
+    committed = snapshot_close(1) == 0;
+
+    /* playlists saved are in the snapshot now, the rest stay journalled */
+    for (i = 0; i < g_nbuckets; i++) {
+        for (w = g_buckets[i]; w; w = w->next) {
+            if (w->dirty < 0) {
+                w->dirty = !committed;
+                if (committed) {
+                    w->lines.len = 0;
+                    w->stale = 0;
+                }
+            }
+        }
+    }
+    if (!committed || rewrite(snapshot_id()) != 0) {
+        return;
+    }
+
+    g_compactions++;
+    g_compacted += saved;
+    g_deferred += dirty - saved;
+    print_watch("WATCH");
+}
+
+/* how long the main loop may sleep before watch_tick has work to do */
+int
+watch_wait_ms(void)
+{
+    double now = now_ms(), due = g_last_compact + g_compact_ms;
+
+    if (g_unsynced && g_last_sync + WATCH_SYNC_MS < due) {
+        due = g_last_sync + WATCH_SYNC_MS;
+    }
+    return due <= now ? 0 : (int)(due - now) + 1;
+}
+
+/**
+ * Sync the journal and compact it when they are due, or compact right
+ * away if force is set.  save writes a playlist as it is now into the
+ * snapshot being built, returning 0 if it can't yet.
+ */
+void
+watch_tick(int (*save)(sp_playlist *, const char *), int force)
+{
+    double now = now_ms();
+
+    if (force || now >= g_last_compact + g_compact_ms) {
+        g_last_compact = now;
+        compact(save);
+    }
+    if (g_unsynced && g_fd >= 0 && (force || now >= g_last_sync + WATCH_SYNC_MS)) {
+        if (fdatasync(g_fd) != 0) {
+            fprintf(stderr, "journal %s: %s\n", g_path, strerror(errno));
+        }
+        g_unsynced = 0;
+        g_last_sync = now;
+    }
+}
+
+void
+print_watch(char *prefix)
+{
+    size_t i, dirty = 0;
+    struct watched *w;
+
+    for (i = 0; i < g_nbuckets; i++) {
+        for (w = g_buckets[i]; w; w = w->next) {
+            dirty += w->dirty != 0;
+        }
+    }
+    fprintf(stderr, "%s watched=%zu dirty=%zu edits=%lu compactions=%lu compacted=%lu deferred=%lu\n",
+            prefix, g_count, dirty, g_edits, g_compactions, g_compacted, g_deferred);
+}
@@ -0,0 +1,8 @@
+int watch_open(const char *path, int compact_secs);
+int watch_add(sp_playlist *, const char *uri);
+void watch_record(sp_playlist *, const char *op, const char *args, size_t len);
+void watch_unresolved(sp_playlist *);
+int watch_commit(uint64_t snapshot_id);
+int watch_wait_ms(void);
+void watch_tick(int (*save)(sp_playlist *, const char *), int force);
+void print_watch(char *);
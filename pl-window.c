@@ -0,0 +1,119 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pl-window.h"
+
+/*
+ * Adaptive limit on the number of playlists loading at once.
+ *
+ * AIMD, as in TCP congestion control: every completed playlist grows the
+ * window by 1/window (about one slot per window's worth of completions)
+ * while load latency stays near the best we've seen and tracks
+ * aren't failing.  When latency climbs past LATENCY_FACTOR times that
+ * baseline, or the error rate passes ERROR_RATE, the window is halved, at
+ * most once per window's worth of completions so one slow batch doesn't
+ * collapse it.
+ *
+ * Tracks that fail never let a playlist complete, so the error rate comes
+ * from playlists whose deadline expired: they are fed back with their
+ * failed and still unloaded tracks and no latency, and can only shrink
+ * the window.
+ */
+
+/* libspotify resolves track metadata in rounds of about this many */
+#define TRACKS_PER_ROUND 50
+#define LATENCY_FACTOR 2.0
+#define ERROR_RATE 0.05
+#define EWMA_WEIGHT 0.2
+
+static pthread_mutex_t g_window_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_min = 1, g_max = 1;
+static double g_window = 1;
+static double g_latency;    /* EWMA of ms per round */
+static double g_baseline;
+static int g_since_decrease;
+static struct timespec g_t0;
+
+static double
+elapsed(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - g_t0.tv_sec) + (ts.tv_nsec - g_t0.tv_nsec) / 1e9;
+}
+
+void
+window_init(int min, int max, int initial)
+{
+    pthread_mutex_lock(&g_window_mutex);
+    g_min = min > 0 ? min : 1;
+    g_max = max > g_min ? max : g_min;
+    g_window = initial < g_min ? g_min : initial > g_max ? g_max : initial;
+    clock_gettime(CLOCK_MONOTONIC, &g_t0);
+    fprintf(stderr, "IW %.1f window=%d min=%d max=%d\n", 0.0, (int)g_window, g_min, g_max);
+    pthread_mutex_unlock(&g_window_mutex);
+}
+
+int
+window_size(void)
+{
+    int w;
+
+    pthread_mutex_lock(&g_window_mutex);
+    w = (int)g_window;
+    pthread_mutex_unlock(&g_window_mutex);
+    return w;
+}
+
+/**
+ * Feed back one finished playlist: how long it took from being started to
+ * completing, its size, and how many of its tracks failed to load.  ms is
+ * negative for a playlist that timed out, which has no latency to give.
+ */
+void
+window_completed(double ms, int num_tracks, int errors)
+{
+    double per = ms / (1 + num_tracks / TRACKS_PER_ROUND);
+    int before, congested, failing;
+
+    pthread_mutex_lock(&g_window_mutex);
+    before = (int)g_window;
+
+    if (ms >= 0) {
+        g_latency = g_latency > 0 ? (1 - EWMA_WEIGHT) * g_latency + EWMA_WEIGHT * per : per;
+        /* compare against the smoothed value so jitter doesn't set the floor */
+        if (g_baseline == 0 || g_latency < g_baseline) {
+            g_baseline = g_latency;
+        }
+    }
+
+    failing = num_tracks > 0 && (double)errors / num_tracks > ERROR_RATE;
+    congested = failing || (ms >= 0 && g_latency > LATENCY_FACTOR * g_baseline);
+
+    if (congested && g_window <= g_min) {
+        /* nothing left to back off: the network got slower, accept that */
+        if (!failing) {
+            g_baseline = g_latency;
+        }
+    } else if (congested) {
+        if (g_since_decrease >= before) {
+            g_window = g_window / 2 < g_min ? g_min : g_window / 2;
+            g_since_decrease = 0;
+        }
+    } else if (ms >= 0 && g_window < g_max) {
+        g_window += 1 / g_window;
+        if (g_window > g_max) {
+            g_window = g_max;
+        }
+    }
+    g_since_decrease++;
+
+    if ((int)g_window != before) {
+        fprintf(stderr, "IW %.1f window=%d latency=%.1fms baseline=%.1fms%s\n",
+                elapsed(), (int)g_window, g_latency, g_baseline,
+                failing ? " failing" : congested ? " congested" : "");
+    }
+    pthread_mutex_unlock(&g_window_mutex);
+}
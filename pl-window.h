@@ -0,0 +1,3 @@
+void window_init(int min, int max, int initial);
+int window_size(void);
+void window_completed(double ms, int num_tracks, int errors);
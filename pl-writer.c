@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/queue.h>
+
+#include "pl-buf.h"
+#include "pl-writer.h"
+
+/*
+ * Output is written by a dedicated thread so a slow disk or a full pipe
+ * never stalls libspotify callbacks.  Producers format into a buffer from
+ * writer_buffer() and hand it over with writer_submit(); the writer thread
+ * writes it out and puts it back on the free list.
+ *
+ * The queue is bounded by depth and by bytes.  A producer that would go
+ * over either limit waits for the writer, which is the backpressure that
+ * stops us holding unbounded formatted output in memory.
+ *
+ * A failed write stops the writer: it drops what is queued and takes no
+ * more, and the next writer_submit or writer_finish on the main thread
+ * sees the error, so px exits from there rather than from under libspotify.
+ */
+
+struct wq_entry {
+    struct pl_buf buf;
+    char *tag;          /* passed to g_on_written once written, see writer_tag */
+    STAILQ_ENTRY(wq_entry) entries;
+};
+
+typedef STAILQ_HEAD(wq_head, wq_entry) wq_queue;
+
+static wq_queue g_full = STAILQ_HEAD_INITIALIZER(g_full);
+static wq_queue g_free = STAILQ_HEAD_INITIALIZER(g_free);
+static pthread_mutex_t g_wq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wq_nonempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_wq_space = PTHREAD_COND_INITIALIZER;
+static pthread_t g_writer;
+
+static int g_fd = -1;
+static int g_max_depth;
+static size_t g_max_bytes;
+static size_t g_buf_size;
+static int g_stopping;
+static int g_error;     /* errno of a failed write, guarded by g_wq_mutex */
+static void (*g_on_written)(const char *, const struct pl_buf *);
+static int (*g_idle_wait)(void);
+static void (*g_on_idle)(void);
+
+/* statistics, guarded by g_wq_mutex */
+static int g_depth, g_peak_depth;
+static size_t g_bytes, g_peak_bytes;
+static unsigned long g_submitted, g_stalls;
+static double g_stall_secs, g_write_secs;
+static unsigned long long g_written;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* give up after a failed write, leaving the error for the main thread */
+static void
+fail(struct wq_entry *failed, int err)
+{
+    struct wq_entry *e;
+
+    fprintf(stderr, "write failed: %s\n", strerror(err));
+    pthread_mutex_lock(&g_wq_mutex);
+    g_error = err;
+    STAILQ_INSERT_HEAD(&g_full, failed, entries);
+    while ((e = STAILQ_FIRST(&g_full)) != NULL) {
+        STAILQ_REMOVE_HEAD(&g_full, entries);
+        free(e->tag);
+        e->tag = NULL;
+        e->buf.len = 0;
+        STAILQ_INSERT_HEAD(&g_free, e, entries);
+    }
+    g_depth = 0;
+    g_bytes = 0;
+    pthread_cond_broadcast(&g_wq_space);
+    pthread_mutex_unlock(&g_wq_mutex);
+}
+
+/* wait up to ms for more output, with g_wq_mutex held */
+static int
+idle_wait(int ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(&g_wq_nonempty, &g_wq_mutex, &ts);
+}
+
+static void *
+writer_thread(void *junk)
+{
+    struct wq_entry *e;
+    size_t len;
+    double t;
+
+    pthread_mutex_lock(&g_wq_mutex);
+    for (;;) {
+        while (STAILQ_EMPTY(&g_full) && !g_stopping) {
+            int ms = g_idle_wait ? g_idle_wait() : -1;
+
+            if (ms < 0) {
+                pthread_cond_wait(&g_wq_nonempty, &g_wq_mutex);
+            } else if (ms == 0 || idle_wait(ms) == ETIMEDOUT) {
+                pthread_mutex_unlock(&g_wq_mutex);
+                g_on_idle();
+                pthread_mutex_lock(&g_wq_mutex);
+            }
+        }
+        if (STAILQ_EMPTY(&g_full)) {
+            break;
+        }
+        e = STAILQ_FIRST(&g_full);
+        STAILQ_REMOVE_HEAD(&g_full, entries);
+        pthread_mutex_unlock(&g_wq_mutex);
+
+        t = now();
+        len = e->buf.len;
+        if (buf_write(&e->buf, g_fd) != 0) {
+            fail(e, errno);
+            return NULL;
+        }
+        t = now() - t;
+
+        if (e->tag) {
+            if (g_on_written) {
+                g_on_written(e->tag, &e->buf);
+            }
+            free(e->tag);
+            e->tag = NULL;
+        }
+
+        e->buf.len = 0;
+
+        pthread_mutex_lock(&g_wq_mutex);
+        g_write_secs += t;
+        g_written += len;
+        g_depth--;
+        g_bytes -= len;
+        STAILQ_INSERT_HEAD(&g_free, e, entries);
+        pthread_cond_broadcast(&g_wq_space);
+    }
+    pthread_mutex_unlock(&g_wq_mutex);
+    return NULL;
+}
+
+static void
+finish_at_exit(void)
+{
+    writer_finish();
+}
+
+void
+writer_start(int fd, int max_depth, size_t max_bytes, size_t buf_size)
+{
+    g_fd = fd;
+    g_max_depth = max_depth > 0 ? max_depth : 1;
+    g_max_bytes = max_bytes;
+    g_buf_size = buf_size;
+    pthread_create(&g_writer, NULL, writer_thread, NULL);
+
+    /* don't lose queued output on the exit(1) paths */
+    atexit(finish_at_exit);
+}
+
+/* an empty buffer to format the next playlist into */
+struct pl_buf *
+writer_buffer(void)
+{
+    struct wq_entry *e;
+
+    pthread_mutex_lock(&g_wq_mutex);
+    e = STAILQ_FIRST(&g_free);
+    if (e) {
+        STAILQ_REMOVE_HEAD(&g_free, entries);
+    }
+    pthread_mutex_unlock(&g_wq_mutex);
+
+    if (e == NULL) {
+        e = malloc(sizeof(*e));
+        if (e == NULL) {
+            fprintf(stderr, "pl-writer: out of memory\n");
+            exit(1);
+        }
+        buf_init(&e->buf, g_buf_size);
+        e->tag = NULL;
+    }
+    return &e->buf;
+}
+
+static struct wq_entry *
+entry_of(struct pl_buf *buf)
+{
+    return (struct wq_entry *)((char *)buf - offsetof(struct wq_entry, buf));
+}
+
+/* call fn on the writer thread with each tag and its buffer, once written */
+void
+writer_on_written(void (*fn)(const char *, const struct pl_buf *))
+{
+    g_on_written = fn;
+}
+
+/*
+ * call fn on the writer thread once it has been idle for wait_ms(), which
+ * is asked again each time and returns -1 while there is nothing to do;
+ * set before writer_start
+ */
+void
+writer_on_idle(int (*wait_ms)(void), void (*fn)(void))
+{
+    g_idle_wait = wait_ms;
+    g_on_idle = fn;
+}
+
+/* label a buffer before submitting it, see writer_on_written */
+void
+writer_tag(struct pl_buf *buf, const char *tag)
+{
+    struct wq_entry *e = entry_of(buf);
+
+    free(e->tag);
+    e->tag = strdup(tag);
+}
+
+/* give back a buffer from writer_buffer without writing it */
+void
+writer_release(struct pl_buf *buf)
+{
+    struct wq_entry *e = entry_of(buf);
+
+    free(e->tag);
+    e->tag = NULL;
+    e->buf.len = 0;
+    pthread_mutex_lock(&g_wq_mutex);
+    STAILQ_INSERT_HEAD(&g_free, e, entries);
+    pthread_mutex_unlock(&g_wq_mutex);
+}
+
+void
+writer_submit(struct pl_buf *buf)
+{
+    struct wq_entry *e = entry_of(buf);
+    double t = 0;
+
+    pthread_mutex_lock(&g_wq_mutex);
+    /* a single oversized playlist is let through an empty queue */
+    if (g_depth >= g_max_depth || (g_max_bytes && g_depth && g_bytes + buf->len > g_max_bytes)) {
+        g_stalls++;
+        t = now();
+        while (!g_error && (g_depth >= g_max_depth ||
+                            (g_max_bytes && g_depth && g_bytes + buf->len > g_max_bytes))) {
+            pthread_cond_wait(&g_wq_space, &g_wq_mutex);
+        }
+        g_stall_secs += now() - t;
+    }
+    if (g_error) {
+        pthread_mutex_unlock(&g_wq_mutex);
+        exit(1);
+    }
+    STAILQ_INSERT_TAIL(&g_full, e, entries);
+    g_submitted++;
+    g_depth++;
+    g_bytes += buf->len;
+    if (g_depth > g_peak_depth) {
+        g_peak_depth = g_depth;
+    }
+    if (g_bytes > g_peak_bytes) {
+        g_peak_bytes = g_bytes;
+    }
+    pthread_cond_signal(&g_wq_nonempty);
+    pthread_mutex_unlock(&g_wq_mutex);
+}
+
+/**
+ * Write out everything queued and stop the writer thread.  Returns -1 if
+ * a write failed, now or earlier.
+ */
+int
+writer_finish(void)
+{
+    int err;
+
+    if (pthread_equal(pthread_self(), g_writer)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&g_wq_mutex);
+    if (g_fd < 0 || g_stopping) {
+        err = g_error;
+        pthread_mutex_unlock(&g_wq_mutex);
+        return err ? -1 : 0;
+    }
+    g_stopping = 1;
+    pthread_cond_signal(&g_wq_nonempty);
+    pthread_mutex_unlock(&g_wq_mutex);
+
+    pthread_join(g_writer, NULL);
+    print_writer("WQ done");
+    return g_error ? -1 : 0;
+}
+
+/* buffers queued for the writer, and bytes it has written so far */
+void
+writer_totals(int *depth, unsigned long long *written)
+{
+    pthread_mutex_lock(&g_wq_mutex);
+    *depth = g_depth;
+    *written = g_written;
+    pthread_mutex_unlock(&g_wq_mutex);
+}
+
+void
+print_writer(char *prefix)
+{
+    pthread_mutex_lock(&g_wq_mutex);
+    fprintf(stderr, "%s depth=%d/%d peak=%d bytes=%zu peak_bytes=%zu "
+            "submitted=%lu written=%llu stalls=%lu stall_s=%.3f write_s=%.3f\n",
+            prefix, g_depth, g_max_depth, g_peak_depth, g_bytes, g_peak_bytes,
+            g_submitted, g_written, g_stalls, g_stall_secs, g_write_secs);
+    pthread_mutex_unlock(&g_wq_mutex);
+}
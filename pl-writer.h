@@ -0,0 +1,10 @@
+void writer_start(int fd, int max_depth, size_t max_bytes, size_t buf_size);
+struct pl_buf *writer_buffer(void);
+void writer_tag(struct pl_buf *, const char *);
+void writer_on_written(void (*)(const char *, const struct pl_buf *));
+void writer_on_idle(int (*wait_ms)(void), void (*)(void));
+void writer_submit(struct pl_buf *);
+void writer_release(struct pl_buf *);
+int writer_finish(void);
+void writer_totals(int *depth, unsigned long long *written);
+void print_writer(char *);
@@ -28,8 +28,10 @@
  */
 
 #include <errno.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,7 +41,25 @@
 
 #include <libspotify/api.h>
 
+#include "link-cache.h"
+#include "pl-buf.h"
+#include "pl-checkpoint.h"
+#include "pl-deadline.h"
+#include "pl-login.h"
+#include "pl-mem.h"
+#include "pl-metrics.h"
+#include "pl-progress.h"
 #include "pl-queue.h"
+#include "pl-raw.h"
+#include "pl-reorder.h"
+#include "pl-ring.h"
+#include "pl-sched.h"
+#include "pl-select.h"
+#include "pl-snapshot.h"
+#include "pl-watch.h"
+#include "pl-window.h"
+#include "pl-writer.h"
+#include "track-cache.h"
 #define SPE(e) if(e){fprintf(stderr, "! %s:%d %s\n", __FILE__, __LINE__, sp_error_message(e));};
 
 /* --- Data --- */
@@ -58,12 +78,62 @@ static int g_notify_do;
 /// The global session handle
 static sp_session *g_sess;
 
-static pthread_mutex_t g_working_mutex;
 static pthread_t g_working_scanner;
 
+/// Safety-net interval for the working queue scanner, in seconds (-s)
+#define SCAN_TIMEOUT 60
+static int g_scan_timeout = SCAN_TIMEOUT;
+/// Events from callbacks and the scanner waiting for the main thread
+#define EVENT_RING_SIZE 4096
+enum { EV_UPDATED, EV_SCAN };
+/// Set once container_loaded has filled the pending queue
+static int g_container_done;
+
+/// Bounds and starting point for the adaptive in-flight window (pl-window.c)
+#define MIN_INFLIGHT 4
+#define MAX_INFLIGHT 200
+#define INITIAL_INFLIGHT 20
+/// Per-playlist deadline, retries and first backoff, in seconds (pl-deadline.c)
+#define DEADLINE 120
+#define RETRIES 3
+#define BACKOFF 5
+/// How often --watch compacts its journal into the snapshot, in seconds (pl-watch.c)
+#define WATCH_COMPACT 300
+/// How often --metrics rewrites its file, in seconds (pl-metrics.c)
+#define METRICS_INTERVAL 10
+/// getopt_long values for options without a short form
+enum { OPT_MIN_INFLIGHT = 256, OPT_MAX_INFLIGHT, OPT_SCHEDULE, OPT_CHECKPOINT, OPT_RESUME,
+       OPT_SNAPSHOT, OPT_TRACK_CACHE, OPT_DEADLINE, OPT_RETRIES, OPT_BACKOFF,
+       OPT_STREAM, OPT_ORDERED, OPT_REORDER_BUFFER, OPT_WATCH, OPT_COMPACT,
+       OPT_MEM_LIMIT, OPT_CACHE, OPT_SETTINGS, OPT_CREDENTIALS, OPT_METRICS,
+       OPT_METRICS_FORMAT, OPT_METRICS_INTERVAL };
+
 // global error variable
 sp_error e;
 
+/* the run has moved on to another phase; see pl-mem.c and pl-metrics.c */
+static void
+enter_phase(const char *name)
+{
+    mem_phase(name);
+    metrics_phase(name);
+}
+
+/* link creation, counted for --metrics */
+static sp_link *
+track_link(sp_track *st)
+{
+    metrics_count(M_TRACK_LINKS);
+    return sp_link_create_from_track(st, 0);
+}
+
+static sp_link *
+playlist_link(sp_playlist *pl)
+{
+    metrics_count(M_PLAYLIST_LINKS);
+    return sp_link_create_from_playlist(pl);
+}
+
 /* --------------------------  PLAYLIST CALLBACKS  ------------------------- */
 /**
  * Callback from libspotify, saying that a track has been added to a playlist.
@@ -117,92 +187,436 @@ void kill_cb(sp_playlist *pl);
 void kill_md(sp_playlist *pl);
 sp_playlistcontainer *g_pc;
 static void notify_main_thread(sp_session *sess);
+static void watch_playlist(sp_playlist *pl, const char *uri);
 
-int show_playlist(sp_playlist *pl)
+/* ----------------------------  OUTPUT FORMATS  --------------------------- */
+/// Default initial size of the per-playlist output buffer (-b)
+#define OUT_BUF_SIZE (256 * 1024)
+
+/// Default bound on output held back by --ordered (--reorder-buffer)
+#define REORDER_BYTES (64 * 1024 * 1024)
+
+/// Default output queue limits (-q, -Q)
+#define OUT_QUEUE_DEPTH 64
+#define OUT_QUEUE_BYTES (64 * 1024 * 1024)
+
+/// The playlist being formatted; handed to the writer thread when complete
+static struct pl_buf *g_out;
+/// Only one playlist is formatted at a time
+static pthread_mutex_t g_show_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * How a playlist is written out.  show_playlist() walks the playlist and
+ * calls these in order: playlist, then for each loaded track, track, artist
+ * for each artist and track_end, and finally playlist_end, which is told
+ * whether any tracks were left out because they never loaded.  Text
+ * records are keyed by playlist_ref(), so a playlist that hasn't changed
+ * dumps to the same bytes on every run.
+ */
+struct dump_ops {
+    void (*playlist)(const char *ref, const char *uri, int num_tracks,
+                     const char *name, const char *owner, const char *desc);
+    void (*track)(const char *ref, int j, const char *creator, const char *uri,
+                  const char *name, int duration, int epoch,
+                  const char *album_uri, const char *album_name);
+    void (*artist)(const char *ref, int j, int i, const char *uri, const char *name);
+    void (*track_end)(const char *ref, int j);
+    void (*playlist_end)(const char *ref, int complete);
+};
+
+static void text_playlist(const char *ref, const char *uri, int num_tracks,
+                          const char *name, const char *owner, const char *desc)
 {
-    int nt = sp_playlist_num_tracks(pl);
-    int j;
-    sp_link *pl_link = sp_link_create_from_playlist(pl);
-    char playlist_uri[1024];
+    buf_printf(g_out, "PLAYLIST %s %d %s\n", ref, num_tracks, name);
+    buf_printf(g_out, "PLAYLIST:URI %s %s\n", ref, uri);
+    buf_printf(g_out, "OWNER %s %s\n", ref, owner);
+    if (desc) {
+        buf_printf(g_out, "DESCRIPTION %s %s\n", ref, desc);
+    }
+}
 
-    if (pl_link == NULL) {
-        fprintf(stderr, "pl_link is NULL, something has gone wrong.\n");
-        return 0;
+static void text_track(const char *ref, int j, const char *creator, const char *uri,
+                       const char *name, int duration, int epoch,
+                       const char *album_uri, const char *album_name)
+{
+    buf_printf(g_out, "TRACK:CREATOR %s %d %s\n", ref, j, creator);
+    buf_printf(g_out, "TRACK:URI %s %d %s\n", ref, j, uri);
+    buf_printf(g_out, "TRACK:NAME %s %d %s\n", ref, j, name);
+    buf_printf(g_out, "TRACK:DURATION %s %d %d\n", ref, j, duration);
+    buf_printf(g_out, "TRACK:EPOCH %s %d %d\n", ref, j, epoch);
+    buf_printf(g_out, "ALBUM:URI %s %d %s\n", ref, j, album_uri);
+    buf_printf(g_out, "ALBUM:NAME %s %d %s\n", ref, j, album_name);
+}
+
+static void text_artist(const char *ref, int j, int i, const char *uri, const char *name)
+{
+    buf_printf(g_out, "ARTIST:URI %s %d %d %s\n", ref, j, i, uri);
+    buf_printf(g_out, "ARTIST:NAME %s %d %d %s\n", ref, j, i, name);
+}
+
+static void text_track_end(const char *ref, int j)
+{
+    buf_printf(g_out, "TRACK:END %s %d\n", ref, j);
+}
+
+static void text_playlist_end(const char *ref, int complete)
+{
+    buf_printf(g_out, complete ? "PLAYLIST:END %s\n" : "PLAYLIST:END %s incomplete\n", ref);
+}
+
+static const struct dump_ops text_ops = {
+    .playlist = &text_playlist,
+    .track = &text_track,
+    .artist = &text_artist,
+    .track_end = &text_track_end,
+    .playlist_end = &text_playlist_end,
+};
+
+/// Record under construction for -F binary, see pl-raw.h
+static struct raw_builder g_raw;
+
+static void binary_playlist(const char *ref, const char *uri, int num_tracks,
+                            const char *name, const char *owner, const char *desc)
+{
+    raw_begin(&g_raw, uri, num_tracks, name, owner, desc);
+}
+
+static void binary_track(const char *ref, int j, const char *creator, const char *uri,
+                         const char *name, int duration, int epoch,
+                         const char *album_uri, const char *album_name)
+{
+    raw_track(&g_raw, j, creator, uri, name, duration, epoch, album_uri, album_name);
+}
+
+static void binary_artist(const char *ref, int j, int i, const char *uri, const char *name)
+{
+    raw_artist(&g_raw, uri, name);
+}
+
+static void binary_track_end(const char *ref, int j)
+{
+}
+
+static void binary_playlist_end(const char *ref, int complete)
+{
+    const unsigned char *record;
+    size_t len;
+
+    if (!complete) {
+        raw_flags(&g_raw, RAW_INCOMPLETE);
     }
+    len = raw_finish(&g_raw, &record);
 
-    sp_link_as_string(pl_link, playlist_uri, 1024);
-    sp_link_release(pl_link);
-    sp_user *pl_user = sp_playlist_owner(pl);
+    buf_append(g_out, record, len);
+}
 
-    if (!pl_user) {
-        fprintf(stderr, "There is no owner of this playlist?\n");
-        exit(1);
+static const struct dump_ops binary_ops = {
+    .playlist = &binary_playlist,
+    .track = &binary_track,
+    .artist = &binary_artist,
+    .track_end = &binary_track_end,
+    .playlist_end = &binary_playlist_end,
+};
+
+/**
+ * The ref text records are keyed by: a 64 bit FNV-1a hash of the playlist
+ * URI, as 16 hex digits.  It is as short as the pointer it replaces but
+ * the same in every run; PLAYLIST:URI gives the URI itself.
+ */
+static void
+playlist_ref(const char *uri, char ref[17])
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*uri) {
+        h = (h ^ (unsigned char)*uri++) * 1099511628211ULL;
     }
+    snprintf(ref, 17, "%016llx", (unsigned long long)h);
+}
+
+/// The output format selected with -F
+static const struct dump_ops *g_dump = &text_ops;
+
+/// Set when --snapshot is given, see pl-snapshot.c
+static int g_snapshot;
+
+/// Set by --stream: write tracks out as the loaded prefix grows
+static int g_stream;
+
+/// Set by --watch: stay logged in after the dump and journal edits (pl-watch.c)
+static int g_watch;
+/// Set once the dump is done and only edits are being journalled
+static int g_watching;
+/// Set by SIGINT or SIGTERM while watching, to compact once more and exit
+static volatile sig_atomic_t g_stop;
+
+/**
+ * Hash of the playlist's name, owner, description and ordered track URIs
+ * and add times, for the snapshot.  Needs the playlist loaded but none of
+ * its tracks.
+ */
+static uint64_t
+playlist_fingerprint(sp_playlist *pl)
+{
+    int nt = sp_playlist_num_tracks(pl);
+    sp_user *owner = sp_playlist_owner(pl);
+    uint64_t h = 0;
+    char track_uri[1024];
+    int j;
 
-    printf("PLAYLIST %p %d %s\n", pl, sp_playlist_num_tracks(pl), sp_playlist_name(pl));
-    printf("OWNER %p %s\n", pl, sp_user_canonical_name(pl_user));
+    h = fingerprint_text(h, sp_playlist_name(pl));
+    h = fingerprint_text(h, owner ? sp_user_canonical_name(owner) : NULL);
+    h = fingerprint_text(h, sp_playlist_get_description(pl));
 
-    {
-        const char *desc = sp_playlist_get_description(pl);
-        if (desc) {
-            printf("DESCRIPTION %p %s\n", pl, desc);
+    for (j = 0; j < nt; j++) {
+        sp_track *st = sp_playlist_track(pl, j);
+        sp_link *l = st ? track_link(st) : NULL;
+
+        track_uri[0] = '\0';
+        if (l) {
+            sp_link_as_string(l, track_uri, sizeof(track_uri));
+            sp_link_release(l);
         }
+        h = fingerprint_add(h, track_uri, sp_playlist_track_create_time(pl, j));
     }
-    
-    for(j=0; j<nt; j++) {
+    return h;
+}
+
+/// Set when --track-cache is given, see track-cache.c
+static int g_track_cache;
+
+/* what the track cache has for a track libspotify hasn't loaded, or NULL */
+static const struct track_meta *
+cached_track(sp_track *st)
+{
+    sp_link *l;
+    char track_uri[1024];
+
+    if (!g_track_cache || st == NULL || (l = track_link(st)) == NULL) {
+        return NULL;
+    }
+    sp_link_as_string(l, track_uri, sizeof(track_uri));
+    sp_link_release(l);
+    return track_cache_get(track_uri);
+}
+
+/* progress fallback: a cached track needn't wait for libspotify */
+static int
+track_cached(sp_track *st)
+{
+    return cached_track(st) != NULL;
+}
+
+/* whether -l asked for this playlist; everything is wanted without -l */
+static int
+playlist_selected(sp_playlist *pl)
+{
+    return !select_active() || select_is_created(pl) || select_name(sp_playlist_name(pl));
+}
+
+/* called by the writer thread once a playlist's output is written */
+static void
+output_written(const char *uri, const struct pl_buf *buf)
+{
+    checkpoint_add(uri);
+    snapshot_add(uri, buf);
+}
+
+/**
+ * Format tracks [from, to) of a playlist into g_out, leaving out those
+ * that haven't loaded and aren't cached.  Returns how many were written.
+ * Called with g_show_mutex held.
+ */
+static int
+format_tracks(sp_playlist *pl, const char *ref, sp_user *pl_user, int from, int to)
+{
+    int j, written = 0;
+
+    for(j=from; j<to; j++) {
         sp_track *st = sp_playlist_track(pl, j);
         int na = sp_track_num_artists(st);
+        const struct track_meta *cached;
 
         if (st && sp_track_is_loaded(st)) {
             {
                 sp_user *user = sp_playlist_track_creator(pl, j);
-                if (!user) {
-                    printf("TRACK:CREATOR %p %d %s\n", pl, j, sp_user_canonical_name(pl_user));
-                } else {
-                    printf("TRACK:CREATOR %p %d %s\n", pl, j, sp_user_canonical_name(user));
-                }
-            }
-            {
                 char track_uri[1024];
-                sp_link *t_sl = sp_link_create_from_track(st, 0);
+                sp_link *t_sl = track_link(st);
+                const struct link_entry *album = album_link(sp_track_album(st));
+
                 sp_link_as_string(t_sl, track_uri, 1024);
                 sp_link_release(t_sl);
-                printf("TRACK:URI %p %d %s\n", pl, j, track_uri);
-                printf("TRACK:NAME %p %d %s\n", pl, j, sp_track_name(st));
-                printf("TRACK:DURATION %p %d %d\n", pl, j, sp_track_duration(st));
-                printf("TRACK:EPOCH %p %d %d\n", pl, j, sp_playlist_track_create_time(pl, j));
-            }
-            {
-                char album_uri[1024];
-                sp_album *sa = sp_track_album(st);
-                sp_link *a_sl = sp_link_create_from_album(sa);
-                sp_link_as_string(a_sl, album_uri, 1024);
-                sp_link_release(a_sl);
-                printf("ALBUM:URI %p %d %s\n", pl, j, album_uri);
-                printf("ALBUM:NAME %p %d %s\n", pl, j, sp_album_name(sa));
+
+                g_dump->track(ref, j, sp_user_canonical_name(user ? user : pl_user),
+                              track_uri, sp_track_name(st), sp_track_duration(st),
+                              sp_playlist_track_create_time(pl, j),
+                              album ? album->uri : "", album ? album->name : "");
+                track_cache_begin(track_uri, sp_track_name(st), sp_track_duration(st),
+                                  album ? album->uri : "", album ? album->name : "");
             }
             {
                 int i;
                 for(i=0; i<na; i++) {
-                    char artist_uri[1024];
-                    sp_artist *artist = sp_track_artist(st, i);
-                    sp_link *l_artist = sp_link_create_from_artist(artist);
-                    sp_link_as_string(l_artist, artist_uri, 1024);
-                    sp_link_release(l_artist);
-                    printf("ARTIST:URI %p %d %d %s\n", pl, j, i, artist_uri);
-                    printf("ARTIST:NAME %p %d %d %s\n", pl, j, i, sp_artist_name(artist));
+                    const struct link_entry *artist = artist_link(sp_track_artist(st, i));
+                    if (artist) {
+                        g_dump->artist(ref, j, i, artist->uri, artist->name);
+                        track_cache_artist(artist->uri, artist->name);
+                    }
                 }
             }
-            printf("TRACK:END %p %d\n", pl, j);
+            g_dump->track_end(ref, j);
+            track_cache_end();
+            track_cache_count(1, 0);
+            written++;
+        } else if ((cached = cached_track(st)) != NULL) {
+            sp_user *user = sp_playlist_track_creator(pl, j);
+            int i;
+
+            g_dump->track(ref, j, sp_user_canonical_name(user ? user : pl_user),
+                          cached->uri, cached->name, cached->duration,
+                          sp_playlist_track_create_time(pl, j),
+                          cached->album_uri, cached->album_name);
+            for (i = 0; i < cached->num_artists; i++) {
+                const char *name, *uri = track_meta_artist(cached, i, &name);
+                g_dump->artist(ref, j, i, uri, name);
+            }
+            g_dump->track_end(ref, j);
+            track_cache_count(0, 1);
+            written++;
+        } else if (g_track_cache) {
+            track_cache_count(0, 0);
         }
     }
-    printf("PLAYLIST:END %p\n", pl);
+    return written;
+}
+
+/**
+ * Write tracks [from, to) of a playlist: the playlist header first if from
+ * is 0, and PLAYLIST:END after them if end is set.  Tracks that haven't
+ * loaded and aren't cached are left out, and the playlist ends marked
+ * incomplete.  A streamed playlist edited under what was already written
+ * gets nothing more but an incomplete PLAYLIST:END.  Returns 0 if the
+ * playlist has no link yet.
+ */
+static int
+show_tracks(sp_playlist *pl, int from, int to, int end)
+{
+    int nt = sp_playlist_num_tracks(pl);
+    int written, complete, spliced = g_stream && progress_spliced(pl);
+    sp_link *pl_link = playlist_link(pl);
+    char playlist_uri[1024], ref[17];
+
+    if (pl_link == NULL) {
+        fprintf(stderr, "pl_link is NULL, something has gone wrong.\n");
+        return 0;
+    }
+
+    sp_link_as_string(pl_link, playlist_uri, 1024);
+    sp_link_release(pl_link);
+    playlist_ref(playlist_uri, ref);
+
+    /* finished by the run we're resuming, but unloaded when we queued it */
+    if (checkpoint_done(playlist_uri)) {
+        fprintf(stderr, "Resume-skip %s\n", playlist_uri);
+        if (end) {
+            reorder_skip_playlist(pl);
+        }
+        return 1;
+    }
+
+    /* queued unloaded, so -l couldn't match its name until it loaded */
+    if (!playlist_selected(pl)) {
+        fprintf(stderr, "Select-skip %s\n", playlist_uri);
+        if (end) {
+            reorder_skip_playlist(pl);
+        }
+        return 1;
+    }
+
+    sp_user *pl_user = sp_playlist_owner(pl);
+
+    if (!pl_user) {
+        fprintf(stderr, "There is no owner of this playlist?\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&g_show_mutex);
+    g_out = writer_buffer();
+    if (from == 0) {
+        g_dump->playlist(ref, playlist_uri, nt, sp_playlist_name(pl),
+                         sp_user_canonical_name(pl_user), sp_playlist_get_description(pl));
+    }
+    if (spliced) {
+        from = to;
+    }
+    written = format_tracks(pl, ref, pl_user, from, to);
+    if (!end) {
+        writer_submit(g_out);
+        g_out = NULL;
+        pthread_mutex_unlock(&g_show_mutex);
+        fprintf(stderr, "Streamed %d-%d/%d %s\n", from, to, nt, playlist_uri);
+        return 1;
+    }
+
+    complete = !spliced && written == to - from;
+    g_dump->playlist_end(ref, complete);
+    if (spliced) {
+        fprintf(stderr, "Spliced %d/%d %s\n", from, nt, playlist_uri);
+    } else if (!complete) {
+        fprintf(stderr, "Incomplete %d/%d %s\n", from + written, nt, playlist_uri);
+    } else if (g_snapshot) {
+        /* an incomplete playlist is left out, so the next run fetches it again */
+        snapshot_expect(playlist_uri, nt, playlist_fingerprint(pl));
+        watch_playlist(pl, playlist_uri);
+    }
+    /*
+     * only the last piece of a complete playlist is tagged, so the
+     * checkpoint sees whole playlists and --resume fetches partial ones again
+     */
+    reorder_submit(pl, g_out, complete ? playlist_uri : NULL);
+    g_out = NULL;
+    pthread_mutex_unlock(&g_show_mutex);
+    sched_output();
     count_playlists_shown++;
     fprintf(stderr, "%d playlists shown\n", count_playlists_shown);
 
     return 1;
 }
 
+/* write out the whole playlist, or what --stream hasn't written yet */
+int show_playlist(sp_playlist *pl)
+{
+    struct timespec t0, t1;
+    int rv;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rv = show_tracks(pl, g_stream ? progress_taken(pl) : 0,
+                     sp_playlist_num_tracks(pl), 1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    metrics_observe(M_SHOW, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return rv;
+}
+
+/**
+ * With --stream, write out the tracks that have loaded, in order, since
+ * the playlist was last looked at.  Call after playlist_populated.
+ */
+static void
+stream_playlist(sp_playlist *pl)
+{
+    int from, to;
+
+    if (!g_stream || !sp_playlist_is_loaded(pl)) {
+        return;
+    }
+    to = progress_take(pl, &from);
+    if (to > from) {
+        show_tracks(pl, from, to, 0);
+    }
+}
+
+
+
 /* forward reference */
 static sp_playlist_callbacks pl_callbacks;
 static sp_playlist_callbacks md_callbacks;
@@ -210,42 +624,158 @@ static sp_playlist_callbacks md_callbacks;
 int
 playlist_populated(sp_playlist *pl)
 {
-    int i, nt = sp_playlist_num_tracks(pl);
-    int loaded = 0;
+    int nt;
+    int outstanding;
 
-    for(i=0; i<nt; i++) {
-        sp_track *st = sp_playlist_track(pl, i);
+    /* an unloaded playlist has no tracks yet, which is not the same as done */
+    if (!sp_playlist_is_loaded(pl)) {
+        fprintf(stderr, "%% unloaded %p\n", pl);
+        return 0;
+    }
+    /* queued unloaded and -l doesn't want it: done, show_tracks skips it */
+    if (!playlist_selected(pl)) {
+        return 1;
+    }
+    outstanding = progress_update(pl, &nt);
 
-        if (st && sp_track_error(st) == SP_ERROR_OK) {
-            loaded++;
-        } else {
-            const char *x = st ? sp_track_name(st) : "[NULL]";
-            fprintf(stderr, "%%! %d/%d %s\n", i, nt, x);
+    fprintf(stderr, "%% %d/%d %s\n", nt - outstanding, nt, sp_playlist_name(pl));
+
+    return outstanding == 0;
+}
+
+/**
+ * Hand an event to the main thread and wake it.  Safe from any thread; the
+ * playlist queues themselves are only touched by the main thread, in
+ * handle_events().
+ */
+void
+post_event(int type, sp_playlist *pl)
+{
+    ring_push(type, pl); /* a full ring turns into a rescan, see pl-ring.c */
+
+    pthread_mutex_lock(&g_notify_mutex);
+    g_notify_do = 1;
+    pthread_cond_signal(&g_notify_cond);
+    pthread_mutex_unlock(&g_notify_mutex);
+}
+
+/* tracks of a playlist that came back with an error, and if stuck is set
+ * those that still haven't loaded */
+static int
+failed_tracks(sp_playlist *pl, int stuck)
+{
+    int nt = sp_playlist_num_tracks(pl);
+    int errors = 0;
+    int j;
+
+    for (j = 0; j < nt; j++) {
+        sp_track *st = sp_playlist_track(pl, j);
+        sp_error te = st ? sp_track_error(st) : SP_ERROR_OK;
+        if (te != SP_ERROR_OK && (stuck || te != SP_ERROR_IS_LOADING)) {
+            errors++;
         }
     }
-    fprintf(stderr, "%% %d/%d %s\n", loaded, nt, sp_playlist_name(pl));
+    return errors;
+}
+
+/**
+ * Tell the in-flight window how long this playlist took and how many of
+ * its tracks came back with an error.  The time goes into --metrics too.
+ */
+static void
+window_feedback(sp_playlist *pl)
+{
+    double ms = progress_elapsed(pl);
+
+    if (ms < 0) {
+        return; /* never fetched, so it says nothing about load latency */
+    }
+    metrics_observe(M_LOAD, ms / 1000);
+    window_completed(ms, sp_playlist_num_tracks(pl), failed_tracks(pl, 0));
+}
 
-    return nt == loaded;
+/* drop everything we hold for a playlist that has been written out */
+static void
+playlist_done(sp_playlist *pl)
+{
+    kill_cb(pl);
+    kill_md(pl);
+    remove_working(pl);
+    progress_forget(pl);
+    deadline_forget(pl);
+    sp_playlist_release(pl);
 }
 
 void
 playlist_deinit(sp_playlist *pl) {
     if (show_playlist(pl)) {
         fprintf(stderr, "FULL %s\n", sp_playlist_name(pl));
-        kill_cb(pl);
-        kill_md(pl);
-        remove_working(pl);
-        sp_playlist_release(pl);
+        if (playlist_selected(pl)) {
+            window_feedback(pl);
+        }
+        playlist_done(pl);
     } else {
         fprintf(stderr, "ERROR in show, leaving on pending list\n");
     }
 }
 
+/**
+ * Out of retries: write out what has loaded, marked incomplete.  A
+ * playlist that never loaded at all has nothing to write, not even a URI.
+ * Either way it stops holding up the run.
+ */
+static void
+playlist_give_up(sp_playlist *pl)
+{
+    if (!sp_playlist_is_loaded(pl)) {
+        fprintf(stderr, "DL dropping %p, never loaded\n", pl);
+        reorder_skip_playlist(pl);
+    } else if (show_playlist(pl)) {
+        fprintf(stderr, "PARTIAL %s\n", sp_playlist_name(pl));
+    } else {
+        return;
+    }
+    playlist_done(pl);
+}
+
+static void start_watching(void);
+
+/* the dump is done: exit, or with --watch carry on journalling edits */
 void
 finished_working(void)
 {
+    int saved = 0;
+
     fprintf(stderr, "All queues empty, exiting\n");
-    sleep(5);
+    reorder_flush();
+    print_reorder("RO");
+    if (writer_finish() != 0) {
+        exit(1);
+    }
+    checkpoint_close();
+    if (g_snapshot) {
+        /*
+         * -l only wrote some playlists, and --resume skips those written
+         * before; the rest stay as they were
+         */
+        if (select_active() || checkpoint_resuming()) {
+            snapshot_keep_rest();
+        }
+        print_snapshot("SNAP");
+        saved = snapshot_close(1) == 0;
+    }
+    print_sched("SCHED");
+    print_deadlines("DL");
+    print_mem("MEM");
+    print_link_cache_stats();
+    if (g_track_cache) {
+        track_cache_close();
+        print_track_cache_stats();
+    }
+    if (g_watch && saved) {
+        start_watching();
+        return;
+    }
     sp_session_logout(g_sess);
     exit(0);
 }
@@ -253,41 +783,88 @@ finished_working(void)
 void
 playlist_next(void)
 {
-    sp_playlist *next = NULL;
-    do {
+    sp_playlist *next;
+
+    if (g_watching) {
+        return;
+    }
+
+    /* top the working queue back up to the current window */
+    while (num_working() < window_size()) {
+        long loaded, outstanding;
+
+        /* finishing playlists call back in here, so this only waits */
+        progress_totals(&loaded, &outstanding);
+        if (!mem_allow(num_working(), loaded, outstanding)) {
+            return;
+        }
+
         fprintf(stderr, "Trying to fetch the next playlist\n");
         next = dequeue_pending();
 
         if (next == NULL) {
-            if (still_working()) {
+            if (still_working() || deadline_backing_off()) {
                 fprintf(stderr, "Empty pending queue, still processing\n");
                 return;
             } else {
-                finished_working();
+                finished_working(); /* returns only to carry on watching */
+                return;
             }
         }
 
         if (playlist_populated(next)) {
             fprintf(stderr, "Dequeue-skip [%s]\n", sp_playlist_name(next));
             playlist_deinit(next);
-            next = NULL;
         } else {
             fprintf(stderr, "Dequeue-fetch [%s]\n", sp_playlist_name(next));
-            e = sp_playlist_add_callbacks(next, &pl_callbacks, (void*)0x1);
-            SPE(e);
+            /* a retry still has its callbacks from the first fetch */
+            if (deadline_attempts(next) == 0) {
+                e = sp_playlist_add_callbacks(next, &pl_callbacks, (void*)0x1);
+                SPE(e);
+                progress_start(next);
+            }
+            deadline_fetch(next);
             queue_working(next);
         }
-    } while (next == NULL);
+    }
 }
 
 static void playlist_metadata(sp_playlist *pl, void *userdata)
 {
-    if (playlist_populated(pl)) {
-        playlist_deinit(pl);
-        playlist_next();
-    } else {
-        fprintf(stderr, "Loading: %s\n", sp_playlist_name(pl));
+    post_event(EV_UPDATED, pl);
+}
+
+/* edits while a playlist loads, which --stream may have written past */
+static void md_tracks_added(sp_playlist *pl, sp_track * const *tracks,
+                            int num_tracks, int position, void *userdata)
+{
+    progress_edited(pl, position);
+}
+
+static void md_tracks_removed(sp_playlist *pl, const int *tracks,
+                              int num_tracks, void *userdata)
+{
+    int first = sp_playlist_num_tracks(pl), i;
+
+    for (i = 0; i < num_tracks; i++) {
+        if (tracks[i] < first) {
+            first = tracks[i];
+        }
     }
+    progress_edited(pl, first);
+}
+
+static void md_tracks_moved(sp_playlist *pl, const int *tracks,
+                            int num_tracks, int new_position, void *userdata)
+{
+    int first = new_position, i;
+
+    for (i = 0; i < num_tracks; i++) {
+        if (tracks[i] < first) {
+            first = tracks[i];
+        }
+    }
+    progress_edited(pl, first);
 }
 
 struct xx {
@@ -299,19 +876,21 @@ int stored = 0;
 
 static sp_playlist_callbacks md_callbacks = {
     .playlist_metadata_updated = &playlist_metadata,
+    .tracks_added = &md_tracks_added,
+    .tracks_removed = &md_tracks_removed,
+    .tracks_moved = &md_tracks_moved,
 };
 
 static void playlist_state_changed(sp_playlist *pl, void *userdata)
 {
     fprintf(stderr, "PSC %p %s\n", userdata, sp_playlist_name(pl));
     if (userdata != 0) {
-        sp_link *spl = sp_link_create_from_playlist(pl);
+        sp_link *spl = playlist_link(pl);
         fprintf(stderr, "PSC/L %p\n", spl);
         if (spl) { /* successful link creation = loaded the playlist */
             sp_link_release(spl);
             fprintf(stderr, "+P u=%p %s (%d) %d\n", userdata, sp_playlist_name(pl), sp_playlist_num_tracks(pl), count_playlists_loaded);
 
-            sp_playlist_add_ref(pl);
             kill_cb(pl);
 
             // add playlist to end of queue without callbacks
@@ -319,19 +898,7 @@ static void playlist_state_changed(sp_playlist *pl, void *userdata)
             // when the queue is N long, process the head of the queue
             sp_playlist_add_callbacks(pl, &md_callbacks, (void*)0x2);
 
-            {
-                int k;
-
-                if(playlist_populated(pl)) {
-                    playlist_deinit(pl);
-                    playlist_next();
-                } else {
-                    for(k=0; k<sp_playlist_num_tracks(pl); k++) {
-                        sp_track *st = sp_playlist_track(pl, k);
-                        fprintf(stderr, "T %d/%p %d %s\n", k, st, sp_track_error(st), sp_playlist_name(pl));
-                    }
-                }
-            }
+            post_event(EV_UPDATED, pl);
         }
         else {
             fprintf(stderr, "?P %p\n", pl);
@@ -362,6 +929,145 @@ void kill_md(sp_playlist *pl) {
 }
 
 
+/* ------------------------------  WATCHING  ------------------------------- */
+#define WATCH_TAG ((void*)0x3)
+
+static sp_playlist_callbacks watch_callbacks;
+
+/* keep a playlist that went into the snapshot subscribed, for its edits */
+static void
+watch_playlist(sp_playlist *pl, const char *uri)
+{
+    if (!g_watch || watch_add(pl, uri) != 0) {
+        return;
+    }
+    sp_playlist_add_ref(pl);
+    e = sp_playlist_add_callbacks(pl, &watch_callbacks, WATCH_TAG);
+    SPE(e);
+}
+
+static void watch_tracks_added(sp_playlist *pl, sp_track * const *tracks,
+                               int num_tracks, int position, void *userdata)
+{
+    struct pl_buf args;
+    char track_uri[1024];
+    int i;
+
+    buf_init(&args, 64 * (num_tracks + 1));
+    buf_printf(&args, "%d", position);
+    for (i = 0; i < num_tracks; i++) {
+        sp_link *l = tracks[i] ? track_link(tracks[i]) : NULL;
+
+        track_uri[0] = '\0';
+        if (l) {
+            sp_link_as_string(l, track_uri, sizeof(track_uri));
+            sp_link_release(l);
+        }
+        /* a replay couldn't rebuild the playlist, so it waits for compaction */
+        if (!track_uri[0]) {
+            buf_free(&args);
+            watch_unresolved(pl);
+            return;
+        }
+        buf_printf(&args, " %s", track_uri);
+    }
+    watch_record(pl, "ADD", args.data, args.len);
+    buf_free(&args);
+}
+
+static void watch_tracks_removed(sp_playlist *pl, const int *tracks,
+                                 int num_tracks, void *userdata)
+{
+    struct pl_buf args;
+    int i;
+
+    buf_init(&args, 12 * (num_tracks + 1));
+    for (i = 0; i < num_tracks; i++) {
+        buf_printf(&args, i ? " %d" : "%d", tracks[i]);
+    }
+    watch_record(pl, "REMOVE", args.data, args.len);
+    buf_free(&args);
+}
+
+static void watch_tracks_moved(sp_playlist *pl, const int *tracks,
+                               int num_tracks, int new_position, void *userdata)
+{
+    struct pl_buf args;
+    int i;
+
+    buf_init(&args, 12 * (num_tracks + 2));
+    buf_printf(&args, "%d", new_position);
+    for (i = 0; i < num_tracks; i++) {
+        buf_printf(&args, " %d", tracks[i]);
+    }
+    watch_record(pl, "MOVE", args.data, args.len);
+    buf_free(&args);
+}
+
+static sp_playlist_callbacks watch_callbacks = {
+    .tracks_added = &watch_tracks_added,
+    .tracks_removed = &watch_tracks_removed,
+    .tracks_moved = &watch_tracks_moved,
+};
+
+/**
+ * Compaction: write a watched playlist as it is now straight into the
+ * snapshot being built.  Returns 0, leaving its edits in the journal,
+ * while any of its tracks is still loading.
+ */
+static int
+watch_save(sp_playlist *pl, const char *uri)
+{
+    int nt = sp_playlist_num_tracks(pl), written;
+    sp_user *pl_user = sp_playlist_owner(pl);
+    struct pl_buf buf;
+    char ref[17];
+
+    if (!sp_playlist_is_loaded(pl) || pl_user == NULL) {
+        return 0;
+    }
+    playlist_ref(uri, ref);
+    buf_init(&buf, 64 * 1024);
+
+    pthread_mutex_lock(&g_show_mutex);
+    g_out = &buf;
+    g_dump->playlist(ref, uri, nt, sp_playlist_name(pl),
+                     sp_user_canonical_name(pl_user), sp_playlist_get_description(pl));
+    written = format_tracks(pl, ref, pl_user, 0, nt);
+    g_dump->playlist_end(ref, 1);
+    g_out = NULL;
+    pthread_mutex_unlock(&g_show_mutex);
+
+    if (written == nt) {
+        snapshot_expect(uri, nt, playlist_fingerprint(pl));
+        snapshot_add(uri, &buf);
+    }
+    buf_free(&buf);
+    return written == nt;
+}
+
+static void
+watch_stop(int sig)
+{
+    g_stop = 1;
+}
+
+/* the dump's snapshot is committed: journal edits against it from now on */
+static void
+start_watching(void)
+{
+    if (watch_commit(snapshot_id()) != 0) {
+        sp_session_logout(g_sess);
+        exit(1);
+    }
+    g_watching = 1;
+    enter_phase("watch");
+    signal(SIGINT, watch_stop);
+    signal(SIGTERM, watch_stop);
+    print_watch("WATCH");
+}
+
+
 /* --------------------  PLAYLIST CONTAINER CALLBACKS  --------------------- */
 /**
  * Callback from libspotify, telling us a playlist was added to the playlist container.
@@ -396,6 +1102,91 @@ static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *pl,
 	sp_playlist_remove_callbacks(pl, &pl_callbacks, NULL);
 }
 
+/**
+ * Whether the run being resumed already wrote this playlist out.  Only
+ * loaded playlists have a link yet; show_playlist catches the rest.
+ */
+static int
+playlist_checkpointed(sp_playlist *pl)
+{
+    sp_link *link = playlist_link(pl);
+    char uri[1024];
+
+    if (link == NULL) {
+        return 0;
+    }
+    sp_link_as_string(link, uri, sizeof(uri));
+    sp_link_release(link);
+    return checkpoint_done(uri);
+}
+
+/**
+ * A playlist the run being resumed already wrote keeps its old snapshot
+ * entry.  If that entry is still current, --watch follows it as though it
+ * had been carried over.
+ */
+static void
+playlist_resumed(sp_playlist *pl)
+{
+    sp_link *link;
+    char uri[1024];
+    int nt = sp_playlist_num_tracks(pl);
+
+    if (!g_watch || (link = playlist_link(pl)) == NULL) {
+        return;
+    }
+    sp_link_as_string(link, uri, sizeof(uri));
+    sp_link_release(link);
+    if (snapshot_known(uri, nt) && snapshot_unchanged(uri, nt, playlist_fingerprint(pl))) {
+        watch_playlist(pl, uri);
+    }
+}
+
+/**
+ * If the snapshot has this playlist with the same tracks, write out what
+ * it had instead of loading the playlist again.  Returns 1 if carried over.
+ */
+static int
+playlist_carry(sp_playlist *pl)
+{
+    sp_link *link = playlist_link(pl);
+    int nt = sp_playlist_num_tracks(pl);
+    struct pl_buf *buf;
+    char uri[1024];
+    uint64_t h;
+
+    if (link == NULL) {
+        return 0;
+    }
+    sp_link_as_string(link, uri, sizeof(uri));
+    sp_link_release(link);
+
+    /* only hash the tracks if the cheap comparison passes */
+    if (!snapshot_known(uri, nt)) {
+        return 0;
+    }
+    h = playlist_fingerprint(pl);
+    if (!snapshot_unchanged(uri, nt, h)) {
+        return 0;
+    }
+
+    buf = writer_buffer();
+    if (snapshot_carry(uri, buf) != 0) {
+        writer_release(buf);
+        return 0;
+    }
+    snapshot_expect(uri, nt, h);
+    watch_playlist(pl, uri);
+    reorder_submit(pl, buf, uri);
+    return 1;
+}
+
+static void
+discard_snapshot(void)
+{
+    snapshot_close(0);
+}
+
 /**
  * Callback from libspotify, telling us the rootlist is fully synchronized
  * We just print an informational message
@@ -405,43 +1196,116 @@ static void playlist_removed(sp_playlistcontainer *pc, sp_playlist *pl,
  */
 static void container_loaded(sp_playlistcontainer *pc, void *userdata)
 {
-    int i;
+    int i, base = select_num_uris();
 
 	fprintf(stderr, "jukebox: Rootlist synchronized (%d playlists)\n",
 	    sp_playlistcontainer_num_playlists(pc));
+    login_mark(1);
+    print_login("START");
+
+    /* -l gave only URIs, which load_selected has queued already */
+    if (select_active() && !select_has_globs()) {
+        return;
+    }
+
     count_playlists_loaded = sp_playlistcontainer_num_playlists(pc);
+    sched_started();
+    enter_phase("fetch");
 
     /* now we can write them all out to xspf */
 	for (i = 0; i < count_playlists_loaded; ++i) {
 		sp_playlist *pl = sp_playlistcontainer_playlist(pc, i);
         sp_playlist_type t = sp_playlistcontainer_playlist_type(pc, i);
 
+        if (t == SP_PLAYLIST_TYPE_PLAYLIST && select_active() &&
+            (select_is_created(pl) || (sp_playlist_is_loaded(pl) && !playlist_selected(pl)))) {
+            reorder_skip(base + i);
+            continue;
+        }
+
         if (t == SP_PLAYLIST_TYPE_PLAYLIST) {
+            reorder_expect(pl, base + i);
+        } else {
+            reorder_skip(base + i);
+        }
+
+        if (t == SP_PLAYLIST_TYPE_PLAYLIST && playlist_checkpointed(pl)) {
+            fprintf(stderr, "Resume-skip #%d [%s]\n", i, sp_playlist_name(pl));
+            playlist_resumed(pl);
+            reorder_skip_playlist(pl);
+        } else if (t == SP_PLAYLIST_TYPE_PLAYLIST && g_snapshot && playlist_carry(pl)) {
+            fprintf(stderr, "Carry-over #%d [%s]\n", i, sp_playlist_name(pl));
+        } else if (t == SP_PLAYLIST_TYPE_PLAYLIST) {
             const char *name = sp_playlist_name(pl);
             if (strlen(name) == 0) {
                 name = NULL;
             }
             fprintf(stderr, "Storing #%d [%s] %d\n", i, name?name:"<NULL>", t);
             sp_playlist_add_ref(pl);
-            if (name == NULL) { // not loaded, prioritise
-                fprintf(stderr, "Prioritising %d, not loaded\n", i);
-                queue_pending_first(pl);
-            } else {
-                queue_pending(pl);
-            }
+            queue_pending(pl, sched_key(pl));
             stored++;
         } else {
             fprintf(stderr, "Ignoring %d because empty or folder\n", i);
         }
     }
     fprintf(stderr, "stored=%d\n", stored);
+    g_container_done = 1;
+
+    /* fire off the first window's worth of playlists to fetch */
+    playlist_next();
+}
 
-    /* fire off the first N playlists to fetch - currently 1 */
-    for(i=0; i<20; i++) {
-        sp_playlist *first = dequeue_pending();
-        e = sp_playlist_add_callbacks(first, &pl_callbacks, (void*)0x1);
-        SPE(e);
-        queue_working(first);
+/**
+ * Queue the playlists -l named by URI straight from their links, ahead of
+ * the rootlist.  If there are no name globs to match, the rootlist isn't
+ * needed at all and fetching starts now.
+ */
+static void
+load_selected(sp_session *sess)
+{
+    int i;
+
+    for (i = 0; i < select_num_uris(); i++) {
+        sp_link *link;
+        sp_playlist *pl = NULL;
+
+        if (checkpoint_done(select_uri(i))) {
+            fprintf(stderr, "Resume-skip %s\n", select_uri(i));
+            reorder_skip(i);
+            continue;
+        }
+        link = sp_link_create_from_string(select_uri(i));
+        metrics_count(M_PLAYLIST_LINKS);
+        if (link != NULL && sp_link_type(link) == SP_LINKTYPE_PLAYLIST) {
+            pl = sp_playlist_create(sess, link);
+        }
+        if (link != NULL) {
+            sp_link_release(link);
+        }
+        if (pl == NULL) {
+            fprintf(stderr, "-l %s: not a playlist\n", select_uri(i));
+            reorder_skip(i);
+            continue;
+        }
+        if (select_is_created(pl)) {
+            fprintf(stderr, "-l %s: given twice\n", select_uri(i));
+            sp_playlist_release(pl);
+            reorder_skip(i);
+            continue;
+        }
+        select_created(pl);
+        reorder_expect(pl, i);
+        fprintf(stderr, "Storing %s\n", select_uri(i));
+        queue_pending(pl, sched_key(pl));
+        stored++;
+    }
+
+    if (!select_has_globs()) {
+        fprintf(stderr, "stored=%d\n", stored);
+        sched_started();
+        enter_phase("fetch");
+        g_container_done = 1;
+        playlist_next();
     }
 }
 
@@ -466,10 +1330,14 @@ static void logged_in(sp_session *sess, sp_error error)
 	sp_playlistcontainer *pc = sp_session_playlistcontainer(sess);
 
 	if (SP_ERROR_OK != error) {
+		if (login_failed(sess, error) == 0) {
+			return;
+		}
 		fprintf(stderr, "jukebox: Login failed: %s\n",
 			sp_error_message(error));
 		exit(2);
 	}
+    login_mark(0);
 
     /* initialise our SLIST */
     init_playlist_queues();
@@ -481,8 +1349,13 @@ static void logged_in(sp_session *sess, sp_error error)
 
     g_pc = pc;
     sp_playlistcontainer_add_ref(pc); /* stop this disappearing */
+    enter_phase("container");
 
 	fprintf(stderr, "jukebox: Looking at %d playlists\n", sp_playlistcontainer_num_playlists(pc));
+
+    if (select_active()) {
+        load_selected(sess);
+    }
 }
 
 /**
@@ -501,18 +1374,30 @@ static void notify_main_thread(sp_session *sess)
 	pthread_mutex_unlock(&g_notify_mutex);
 }
 
+/**
+ * This callback is called after a login with a blob that can log in again
+ * in place of the password.  We keep it for --credentials.
+ *
+ * @sa sp_session_callbacks#credentials_blob_updated
+ */
+static void credentials_blob_updated(sp_session *sess, const char *blob)
+{
+    login_blob_updated(blob);
+}
+
 /**
  * The session callbacks
  */
 static sp_session_callbacks session_callbacks = {
 	.logged_in = &logged_in,
 	.notify_main_thread = &notify_main_thread,
+	.credentials_blob_updated = &credentials_blob_updated,
 	.log_message = NULL,
 };
 
 /**
  * The session configuration. Note that application_key_size is an external, so
- * we set it in main() instead.
+ * we set it in main() instead, along with --cache and --settings.
  */
 static sp_session_config spconfig = {
 	.api_version = SPOTIFY_API_VERSION,
@@ -534,34 +1419,125 @@ static sp_session_config spconfig = {
  */
 static void usage(const char *progname)
 {
-	fprintf(stderr, "usage: %s -u <username> -p <password> -l <listname> [-d]\n", progname);
+	fprintf(stderr, "usage: %s -u <username> [-p <password>] [-l <uri>|@<file>|<glob>]... [-d] [-F text|binary] [-b <bufsize>]\n"
+	                "       [-q <queue depth>] [-Q <queue bytes>] [-s <scan seconds>]\n"
+	                "       [--min-inflight <n>] [--max-inflight <n>]\n"
+	                "       [--schedule fifo|unloaded|shortest|owner]\n"
+	                "       [--checkpoint <file> [--resume]] [--snapshot <file>]\n"
+	                "       [--track-cache <file>]\n"
+	                "       [--deadline <secs>] [--retries <n>] [--backoff <secs>] [--stream]\n"
+	                "       [--ordered [--reorder-buffer <bytes>]]\n"
+	                "       [--watch <journal> [--compact <secs>]] [--mem-limit <bytes>]\n"
+	                "       [--cache <dir>] [--settings <dir>] [--credentials <file>]\n"
+	                "       [--metrics <file> [--metrics-format json|prometheus] [--metrics-interval <secs>]]\n", progname);
+	fprintf(stderr, "-p may be left out once --credentials holds a saved login\n");
 	fprintf(stderr, "warning: -d will delete the tracks played from the list!\n");
 }
 
-void *
-scan_working(void *junk)
+/**
+ * Act on the events posted by callbacks and the scanner.  Runs on the main
+ * thread, which owns the playlist queues, after sp_session_process_events
+ * returns, so a playlist is never released from inside its own callback.
+ */
+static void
+handle_events(void)
 {
-    while (1) {
-        fprintf(stderr, "QW working queue cleaner running\n");
-        pthread_mutex_lock(&g_working_mutex);
-        if (deinit_finished_working(playlist_populated, playlist_deinit)) {
-            playlist_next();
-        }
-        pthread_mutex_unlock(&g_working_mutex);
-        fprintf(stderr, "QW working queue cleaner sleeping\n");
-        sleep(20);
+    struct ring_event ev;
+    int handled = 0, scan = 0;
+
+    while (ring_pop(&ev)) {
+        handled = 1;
+        switch (ev.type) {
+        case EV_UPDATED:
+            /* may have been released since, so only the pointer is safe */
+            if (!is_working(ev.pl)) {
+                fprintf(stderr, "Done already: %p\n", ev.pl);
+            } else if (playlist_populated(ev.pl)) {
+                playlist_deinit(ev.pl);
+            } else {
+                stream_playlist(ev.pl);
+            }
+            break;
 
-//        fprintf(stderr, "QP pending queue cleaner running\n");
-//        playlist_next();
+        case EV_SCAN:
+            scan = 1;
+            break;
+        }
+    }
+    if (ring_overflowed()) {
+        fprintf(stderr, "QW events dropped, rescanning\n");
+        scan = 1;
+    }
 
+    if (scan) {
+        fprintf(stderr, "QW working queue cleaner running\n");
+        deinit_finished_working(playlist_populated, playlist_deinit);
         fprintf(stderr, "Q? p=%d w=%d\n", still_pending(), still_working());
-        if (!still_pending() && !still_working()) {
-            finished_working();
+        print_writer("WQ");
+        print_ring("QR");
+    }
+
+    if ((handled || scan) && g_container_done) {
+        playlist_next(); /* exits once everything is done */
+    }
+
+    if (scan) {
+        print_pending("P!");
+        print_working("W!");
+    }
+}
+
+/**
+ * Act on playlist deadlines that have passed.  A playlist still loading
+ * at its deadline is parked out of the working queue and fetched again
+ * after a backoff, or written out partially once it is out of retries.
+ */
+static void
+handle_deadlines(void)
+{
+    sp_playlist *pl;
+    int kind, fired = 0;
+
+    while (deadline_expired(&pl, &kind)) {
+        fired = 1;
+        if (kind == DL_RETRY) {
+            queue_pending_first(pl);
+            continue;
+        }
+        if (!is_working(pl)) {
+            continue;
+        }
+        if (playlist_populated(pl)) {
+            playlist_deinit(pl); /* its last callback went missing */
+            continue;
+        }
+
+        /* timed out: its stuck tracks count against the window, its time doesn't */
+        if (sp_playlist_is_loaded(pl)) {
+            window_completed(-1, sp_playlist_num_tracks(pl), failed_tracks(pl, 1));
+        }
+        if (deadline_retry(pl)) {
+            remove_working(pl);
         } else {
-            print_pending("P!");
-            print_working("W!");
+            playlist_give_up(pl);
         }
-        sleep(5);
+    }
+
+    if (fired && g_container_done) {
+        playlist_next();
+    }
+}
+
+/**
+ * Safety net for missed callbacks: every -s seconds, ask the main thread
+ * to re-check the whole working queue.
+ */
+void *
+scan_working(void *junk)
+{
+    while (1) {
+        sleep(g_scan_timeout);
+        post_event(EV_SCAN, NULL);
     }
 }
 
@@ -573,9 +1549,158 @@ int main(int argc, char **argv)
 	const char *username = NULL;
 	const char *password = NULL;
 	int opt;
-
-	while ((opt = getopt(argc, argv, "u:p:l:d")) != EOF) {
+	size_t out_buf_size = OUT_BUF_SIZE;
+	int out_queue_depth = OUT_QUEUE_DEPTH;
+	size_t out_queue_bytes = OUT_QUEUE_BYTES;
+	int min_inflight = MIN_INFLIGHT;
+	int deadline = DEADLINE, retries = RETRIES, backoff = BACKOFF;
+	int max_inflight = MAX_INFLIGHT;
+	const char *checkpoint = NULL;
+	const char *snapshot = NULL;
+	const char *track_cache = NULL;
+	int resume = 0;
+	int ordered = 0;
+	size_t reorder_bytes = REORDER_BYTES;
+	const char *journal = NULL;
+	int compact = WATCH_COMPACT;
+	size_t mem_limit = 0;
+	const char *credentials = NULL;
+	int have_blob;
+	const char *settings = NULL;
+	const char *metrics = NULL;
+	const char *metrics_format = NULL;
+	int metrics_interval = METRICS_INTERVAL;
+	static const struct option longopts[] = {
+		{ "min-inflight", required_argument, NULL, OPT_MIN_INFLIGHT },
+		{ "max-inflight", required_argument, NULL, OPT_MAX_INFLIGHT },
+		{ "schedule", required_argument, NULL, OPT_SCHEDULE },
+		{ "checkpoint", required_argument, NULL, OPT_CHECKPOINT },
+		{ "resume", no_argument, NULL, OPT_RESUME },
+		{ "snapshot", required_argument, NULL, OPT_SNAPSHOT },
+		{ "track-cache", required_argument, NULL, OPT_TRACK_CACHE },
+		{ "deadline", required_argument, NULL, OPT_DEADLINE },
+		{ "retries", required_argument, NULL, OPT_RETRIES },
+		{ "backoff", required_argument, NULL, OPT_BACKOFF },
+		{ "stream", no_argument, NULL, OPT_STREAM },
+		{ "ordered", no_argument, NULL, OPT_ORDERED },
+		{ "reorder-buffer", required_argument, NULL, OPT_REORDER_BUFFER },
+		{ "watch", required_argument, NULL, OPT_WATCH },
+		{ "compact", required_argument, NULL, OPT_COMPACT },
+		{ "mem-limit", required_argument, NULL, OPT_MEM_LIMIT },
+		{ "cache", required_argument, NULL, OPT_CACHE },
+		{ "settings", required_argument, NULL, OPT_SETTINGS },
+		{ "credentials", required_argument, NULL, OPT_CREDENTIALS },
+		{ "metrics", required_argument, NULL, OPT_METRICS },
+		{ "metrics-format", required_argument, NULL, OPT_METRICS_FORMAT },
+		{ "metrics-interval", required_argument, NULL, OPT_METRICS_INTERVAL },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "u:p:l:dF:b:q:Q:s:", longopts, NULL)) != EOF) {
 		switch (opt) {
+		case OPT_MIN_INFLIGHT:
+			min_inflight = atoi(optarg);
+			break;
+
+		case OPT_MAX_INFLIGHT:
+			max_inflight = atoi(optarg);
+			break;
+
+		case OPT_CHECKPOINT:
+			checkpoint = optarg;
+			break;
+
+		case OPT_RESUME:
+			resume = 1;
+			break;
+
+		case OPT_SNAPSHOT:
+			snapshot = optarg;
+			break;
+
+		case OPT_DEADLINE:
+			deadline = atoi(optarg);
+			break;
+
+		case OPT_RETRIES:
+			retries = atoi(optarg);
+			break;
+
+		case OPT_BACKOFF:
+			backoff = atoi(optarg);
+			break;
+
+		case OPT_ORDERED:
+			ordered = 1;
+			break;
+
+		case OPT_REORDER_BUFFER:
+			if (parse_size(optarg, &reorder_bytes) != 0) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case OPT_STREAM:
+			g_stream = 1;
+			break;
+
+		case OPT_WATCH:
+			journal = optarg;
+			break;
+
+		case OPT_MEM_LIMIT:
+			if (parse_size(optarg, &mem_limit) != 0) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case OPT_CACHE:
+			spconfig.cache_location = optarg;
+			break;
+
+		case OPT_SETTINGS:
+			settings = optarg;
+			break;
+
+		case OPT_CREDENTIALS:
+			credentials = optarg;
+			break;
+
+		case OPT_METRICS:
+			metrics = optarg;
+			break;
+
+		case OPT_METRICS_FORMAT:
+			metrics_format = optarg;
+			break;
+
+		case OPT_METRICS_INTERVAL:
+			metrics_interval = atoi(optarg);
+			if (metrics_interval < 1) {
+				metrics_interval = 1;
+			}
+			break;
+
+		case OPT_COMPACT:
+			compact = atoi(optarg);
+			if (compact < 1) {
+				compact = 1;
+			}
+			break;
+
+		case OPT_TRACK_CACHE:
+			track_cache = optarg;
+			break;
+
+		case OPT_SCHEDULE:
+			if (sched_policy(optarg) != 0) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
 		case 'u':
 			username = optarg;
 			break;
@@ -584,18 +1709,113 @@ int main(int argc, char **argv)
 			password = optarg;
 			break;
 
+		case 'l':
+			if (select_add(optarg) != 0) {
+				exit(1);
+			}
+			break;
+
+		case 'b':
+			if (parse_size(optarg, &out_buf_size) != 0) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 'q':
+			out_queue_depth = atoi(optarg);
+			break;
+
+		case 'Q':
+			if (parse_size(optarg, &out_queue_bytes) != 0) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 's':
+			g_scan_timeout = atoi(optarg);
+			if (g_scan_timeout < 1) {
+				g_scan_timeout = 1;
+			}
+			break;
+
+		case 'F':
+			if (strcmp(optarg, "binary") == 0) {
+				g_dump = &binary_ops;
+			} else if (strcmp(optarg, "text") == 0) {
+				g_dump = &text_ops;
+			} else {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
 		default:
 			exit(1);
 		}
 	}
 
-	if (!username || !password) {
+	/* a saved login stands in for -p */
+	have_blob = login_init(credentials);
+
+	/* binary records, snapshot entries and reordering all work on whole playlists */
+	if (!username || (!have_blob && !password) || (resume && !checkpoint) || (journal && !snapshot) ||
+	    (g_stream && (g_dump == &binary_ops || snapshot || ordered))) {
 		usage(basename(argv[0]));
 		exit(1);
 	}
 
+	/* registered before the writer's atexit, so it runs after the writer drains */
+	if (checkpoint) {
+		if (checkpoint_open(checkpoint, resume, STDOUT_FILENO) != 0) {
+			exit(1);
+		}
+		atexit(checkpoint_close);
+		writer_on_idle(checkpoint_wait_ms, checkpoint_tick);
+	}
+	if (snapshot) {
+		if (snapshot_open(snapshot, g_dump == &binary_ops) != 0) {
+			exit(1);
+		}
+		g_snapshot = 1;
+		atexit(discard_snapshot);
+	}
+	if (journal) {
+		watch_open(journal, compact);
+		g_watch = 1;
+	}
+	if (track_cache) {
+		if (track_cache_open(track_cache) != 0) {
+			exit(1);
+		}
+		g_track_cache = 1;
+		progress_fallback(track_cached);
+		atexit(track_cache_close);
+	}
+	writer_on_written(output_written);
+
+	mem_init(mem_limit);
+	if (metrics && metrics_open(metrics, metrics_format, metrics_interval) != 0) {
+		exit(1);
+	}
+	window_init(min_inflight, max_inflight, INITIAL_INFLIGHT);
+	deadline_init(deadline * 1000, retries, backoff * 1000);
+	if (ordered) {
+		reorder_init(reorder_bytes);
+	}
+	writer_start(STDOUT_FILENO, out_queue_depth, out_queue_bytes, out_buf_size);
+	if (g_dump == &binary_ops) {
+		struct pl_buf *magic = writer_buffer();
+		raw_builder_init(&g_raw);
+		buf_append(magic, RAW_MAGIC, RAW_MAGIC_LEN);
+		writer_submit(magic);
+	}
+
 	/* Create session */
 	spconfig.application_key_size = g_appkey_size;
+	/* settings live with the cache unless told otherwise */
+	spconfig.settings_location = settings ? settings : spconfig.cache_location;
     spconfig.initially_unload_playlists = 0;
 
 	err = sp_session_create(&spconfig, &sp);
@@ -611,10 +1831,10 @@ int main(int argc, char **argv)
 	pthread_mutex_init(&g_notify_mutex, NULL);
     pthread_cond_init(&g_notify_cond, NULL);
 
-    pthread_mutex_init(&g_working_mutex, NULL);
+    ring_init(EVENT_RING_SIZE);
     pthread_create(&g_working_scanner, NULL, scan_working, NULL);
 
-	sp_session_login(sp, username, password, 0, NULL);
+	login_start(sp, username, password);
 	pthread_mutex_lock(&g_notify_mutex);
 
 	for (;;) {
@@ -625,6 +1845,7 @@ int main(int argc, char **argv)
 				pthread_cond_wait(&g_notify_cond, &g_notify_mutex);
 		} else {
 			struct timespec ts;
+			int wait_ms;
 
 #if _POSIX_TIMERS > 0
 			clock_gettime(CLOCK_REALTIME, &ts);
@@ -634,19 +1855,48 @@ int main(int argc, char **argv)
 			TIMEVAL_TO_TIMESPEC(&tv, &ts);
 #endif
             next_timeout = 2.0 * next_timeout;
-			ts.tv_sec += next_timeout / 1000;
-			ts.tv_nsec += (next_timeout % 1000) * 1000000;
-
-			pthread_cond_timedwait(&g_notify_cond, &g_notify_mutex, &ts);
+			/* wake in time for the next playlist deadline */
+			wait_ms = deadline_wait_ms();
+			if (wait_ms < 0 || wait_ms > next_timeout)
+				wait_ms = next_timeout;
+			if (g_watching && watch_wait_ms() < wait_ms)
+				wait_ms = watch_wait_ms();
+			if (metrics && metrics_wait_ms() < wait_ms)
+				wait_ms = metrics_wait_ms();
+			ts.tv_sec += wait_ms / 1000;
+			ts.tv_nsec += (wait_ms % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			/* don't sleep through a notify that came in while we were busy */
+			if (!g_notify_do)
+				pthread_cond_timedwait(&g_notify_cond, &g_notify_mutex, &ts);
 		}
 
 		g_notify_do = 0;
 		pthread_mutex_unlock(&g_notify_mutex);
 
+		/* checked before taking any more edits, so the journal ends here */
+		if (g_stop) {
+			watch_tick(watch_save, 1);
+			print_watch("WATCH");
+			print_mem("MEM");
+			sp_session_logout(sp);
+			exit(0);
+		}
+
 		do {
 			sp_session_process_events(sp, &next_timeout);
+			handle_events();
+			handle_deadlines();
 		} while (next_timeout == 0);
 
+		if (g_watching)
+			watch_tick(watch_save, 0);
+		metrics_tick();
+
 		pthread_mutex_lock(&g_notify_mutex);
 	}
 
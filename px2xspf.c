@@ -0,0 +1,522 @@
+/*
+ * px2xspf - convert the raw px dump into XSPF playlists.
+ *
+ * A one pass replacement for xspf.rb.  Records are read from stdin a line
+ * at a time (or a record at a time for -F binary dumps), tracks are
+ * written to the playlist's file as their TRACK:END arrives and the
+ * finished file is renamed to playlists/N.xspf when its PLAYLIST:END
+ * arrives, so memory use is bounded by the largest track and not by the
+ * dump.
+ *
+ * Text records are matched to their playlist by ref, so the interleaved
+ * chunks px writes with --stream convert too: every playlist between its
+ * PLAYLIST and PLAYLIST:END has its own file open.
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pl-raw.h"
+
+#define META_BASE "http://browser.org/xspf/spotify/"
+
+struct artist {
+    char *uri;
+    char *name;
+};
+
+/* the track currently being assembled, reused for every track */
+struct track {
+    int index;
+    char *creator;
+    char *uri;
+    char *name;
+    char *duration;
+    char *epoch;
+    char *album_uri;
+    char *album_name;
+    struct artist *artists;
+    int num_artists;
+    int max_artists;
+};
+
+/* the playlist currently being written */
+struct playlist {
+    FILE *fp;
+    char *ref;
+    char *title;
+    char *owner;
+    char *description;
+    int header_done;
+    int tracks;
+    int id;             /* names its temporary file */
+};
+
+static const char *g_dir = "playlists";
+static int g_written = 0;
+/* playlists begun but not yet ended, and the one last looked up */
+static struct playlist **g_open;
+static int g_num_open, g_max_open, g_next_id;
+static struct playlist *g_last;
+static struct track g_track;
+
+static void
+set(char **field, const char *value)
+{
+    free(*field);
+    *field = value ? strdup(value) : NULL;
+}
+
+static void
+xml_puts(FILE *fp, const char *s)
+{
+    for (; *s; s++) {
+        switch (*s) {
+        case '&': fputs("&amp;", fp); break;
+        case '<': fputs("&lt;", fp); break;
+        case '>': fputs("&gt;", fp); break;
+        case '"': fputs("&quot;", fp); break;
+        case '\'': fputs("&apos;", fp); break;
+        default:
+            /* control characters are not allowed in XML 1.0 */
+            if ((unsigned char)*s >= 0x20 || *s == '\t' || *s == '\n' || *s == '\r') {
+                putc(*s, fp);
+            }
+        }
+    }
+}
+
+static void
+xml_element(FILE *fp, const char *indent, const char *tag, const char *value)
+{
+    if (value == NULL || *value == '\0') {
+        return;
+    }
+    fprintf(fp, "%s<%s>", indent, tag);
+    xml_puts(fp, value);
+    fprintf(fp, "</%s>\n", tag);
+}
+
+static void
+xml_meta(FILE *fp, const char *rel, const char *value)
+{
+    if (value == NULL || *value == '\0') {
+        return;
+    }
+    fprintf(fp, "      <meta rel=\"" META_BASE "%s\">", rel);
+    xml_puts(fp, value);
+    fputs("</meta>\n", fp);
+}
+
+static void
+tmp_path(const struct playlist *p, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s/.px2xspf.%d.%d.tmp", g_dir, (int)getpid(), p->id);
+}
+
+static void
+reset_track(struct track *t)
+{
+    int i;
+
+    set(&t->creator, NULL);
+    set(&t->uri, NULL);
+    set(&t->name, NULL);
+    set(&t->duration, NULL);
+    set(&t->epoch, NULL);
+    set(&t->album_uri, NULL);
+    set(&t->album_name, NULL);
+    for (i = 0; i < t->num_artists; i++) {
+        set(&t->artists[i].uri, NULL);
+        set(&t->artists[i].name, NULL);
+    }
+    t->num_artists = 0;
+    t->index = -1;
+}
+
+static struct artist *
+track_artist(struct track *t, int i)
+{
+    if (i < 0) {
+        return NULL;
+    }
+    if (i >= t->max_artists) {
+        int n = t->max_artists ? t->max_artists : 4;
+        while (n <= i) {
+            n *= 2;
+        }
+        t->artists = realloc(t->artists, n * sizeof(*t->artists));
+        memset(t->artists + t->max_artists, 0, (n - t->max_artists) * sizeof(*t->artists));
+        t->max_artists = n;
+    }
+    if (i >= t->num_artists) {
+        t->num_artists = i + 1;
+    }
+    return &t->artists[i];
+}
+
+static void
+playlist_header(struct playlist *p)
+{
+    if (p->header_done) {
+        return;
+    }
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n", p->fp);
+    xml_element(p->fp, "  ", "title", p->title);
+    xml_element(p->fp, "  ", "creator", p->owner);
+    xml_element(p->fp, "  ", "annotation", p->description);
+    fputs("  <trackList>\n", p->fp);
+    p->header_done = 1;
+}
+
+static struct playlist *
+find_playlist(const char *ref)
+{
+    int i;
+
+    if (g_last && strcmp(g_last->ref, ref) == 0) {
+        return g_last;
+    }
+    for (i = 0; i < g_num_open; i++) {
+        if (strcmp(g_open[i]->ref, ref) == 0) {
+            return g_last = g_open[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+playlist_close(struct playlist *p)
+{
+    int i;
+
+    for (i = 0; i < g_num_open && g_open[i] != p; i++) {
+    }
+    g_open[i] = g_open[--g_num_open];
+    if (g_last == p) {
+        g_last = NULL;
+    }
+    set(&p->ref, NULL);
+    set(&p->title, NULL);
+    set(&p->owner, NULL);
+    set(&p->description, NULL);
+    free(p);
+}
+
+static void
+playlist_discard(struct playlist *p)
+{
+    char tmp[1024];
+
+    fprintf(stderr, "px2xspf: playlist %s has no PLAYLIST:END, discarding\n", p->ref);
+    fclose(p->fp);
+    tmp_path(p, tmp, sizeof(tmp));
+    unlink(tmp);
+    playlist_close(p);
+}
+
+static struct playlist *
+playlist_begin(const char *ref, const char *title)
+{
+    struct playlist *p = find_playlist(ref);
+    char path[1024];
+
+    if (p) {
+        playlist_discard(p);
+    }
+    if (g_num_open == g_max_open) {
+        g_max_open = g_max_open ? 2 * g_max_open : 16;
+        g_open = realloc(g_open, g_max_open * sizeof(*g_open));
+    }
+    p = calloc(1, sizeof(*p));
+    if (p == NULL || g_open == NULL) {
+        fprintf(stderr, "px2xspf: out of memory\n");
+        exit(1);
+    }
+    p->id = g_next_id++;
+    g_open[g_num_open++] = g_last = p;
+
+    tmp_path(p, path, sizeof(path));
+    p->fp = fopen(path, "w");
+    if (p->fp == NULL) {
+        fprintf(stderr, "px2xspf: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    set(&p->ref, ref);
+    set(&p->title, title);
+    set(&p->owner, NULL);
+    set(&p->description, NULL);
+    p->header_done = 0;
+    p->tracks = 0;
+    return p;
+}
+
+static void
+playlist_track(struct playlist *p, struct track *t)
+{
+    FILE *fp = p->fp;
+    int i;
+
+    playlist_header(p);
+
+    fputs("    <track>\n", fp);
+    xml_element(fp, "      ", "identifier", t->uri);
+    xml_element(fp, "      ", "title", t->name);
+    if (t->num_artists > 0) {
+        fputs("      <creator>", fp);
+        for (i = 0; i < t->num_artists; i++) {
+            if (i > 0) {
+                fputs(", ", fp);
+            }
+            xml_puts(fp, t->artists[i].name ? t->artists[i].name : "");
+        }
+        fputs("</creator>\n", fp);
+    }
+    xml_element(fp, "      ", "album", t->album_name);
+    fprintf(fp, "      <trackNum>%d</trackNum>\n", t->index + 1);
+    xml_element(fp, "      ", "duration", t->duration);
+    xml_meta(fp, "added_by", t->creator);
+    xml_meta(fp, "added_time", t->epoch);
+    xml_meta(fp, "track", t->uri);
+    xml_meta(fp, "album", t->album_uri);
+    for (i = 0; i < t->num_artists; i++) {
+        xml_meta(fp, "artist", t->artists[i].uri);
+    }
+    fputs("    </track>\n", fp);
+    p->tracks++;
+}
+
+static void
+playlist_end(struct playlist *p, int complete)
+{
+    char tmp[1024], path[1024];
+    if (!complete) {
+        fprintf(stderr, "px2xspf: playlist %s is incomplete, some tracks never loaded\n",
+                p->title ? p->title : p->ref);
+    }
+
+    playlist_header(p);
+    fputs("  </trackList>\n</playlist>\n", p->fp);
+    if (fclose(p->fp) != 0) {
+        fprintf(stderr, "px2xspf: write failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    p->fp = NULL;
+
+    tmp_path(p, tmp, sizeof(tmp));
+    snprintf(path, sizeof(path), "%s/%d.xspf", g_dir, g_written);
+    if (rename(tmp, path) != 0) {
+        fprintf(stderr, "px2xspf: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    g_written++;
+    printf("Written %d %s\n", g_written, p->title ? p->title : "");
+    playlist_close(p);
+}
+
+/* split off the next space separated word, returning the remainder */
+static char *
+word(char **s)
+{
+    char *w = *s, *sp;
+
+    if (w == NULL) {
+        return NULL;
+    }
+    sp = strchr(w, ' ');
+    if (sp) {
+        *sp = '\0';
+        *s = sp + 1;
+    } else {
+        *s = NULL;
+    }
+    return w;
+}
+
+static int
+number(char **s, int def)
+{
+    char *w = word(s);
+    return w ? atoi(w) : def;
+}
+
+static void
+parse_line(char *line)
+{
+    char *rest = line;
+    char *tag = word(&rest);
+    char *ref = word(&rest);
+    struct track *t = &g_track;
+    struct playlist *p;
+    int index;
+
+    if (tag == NULL || ref == NULL) {
+        return;
+    }
+
+    if (strcmp(tag, "PLAYLIST") == 0) {
+        word(&rest); /* track count */
+        playlist_begin(ref, rest ? rest : "");
+        return;
+    }
+    if ((p = find_playlist(ref)) == NULL) {
+        return;
+    }
+    if (strcmp(tag, "PLAYLIST:END") == 0) {
+        char *flag = word(&rest);
+        playlist_end(p, flag == NULL || strcmp(flag, "incomplete") != 0);
+        return;
+    }
+    if (strcmp(tag, "PLAYLIST:URI") == 0) {
+        return;
+    }
+    if (strcmp(tag, "OWNER") == 0) {
+        set(&p->owner, rest);
+        return;
+    }
+    if (strcmp(tag, "DESCRIPTION") == 0) {
+        set(&p->description, rest);
+        return;
+    }
+
+    /* everything else is per track: TAG ref index ... */
+    index = number(&rest, 0);
+    if (t->index != index) {
+        reset_track(t);
+        t->index = index;
+    }
+
+    if (strcmp(tag, "TRACK:CREATOR") == 0) {
+        set(&t->creator, rest);
+    } else if (strcmp(tag, "TRACK:URI") == 0) {
+        set(&t->uri, rest);
+    } else if (strcmp(tag, "TRACK:NAME") == 0) {
+        set(&t->name, rest);
+    } else if (strcmp(tag, "TRACK:DURATION") == 0) {
+        set(&t->duration, rest);
+    } else if (strcmp(tag, "TRACK:EPOCH") == 0) {
+        set(&t->epoch, rest);
+    } else if (strcmp(tag, "ALBUM:URI") == 0) {
+        set(&t->album_uri, rest);
+    } else if (strcmp(tag, "ALBUM:NAME") == 0) {
+        set(&t->album_name, rest);
+    } else if (strcmp(tag, "ARTIST:URI") == 0 || strcmp(tag, "ARTIST:NAME") == 0) {
+        struct artist *a = track_artist(t, number(&rest, -1));
+        if (a) {
+            set(tag[7] == 'U' ? &a->uri : &a->name, rest);
+        }
+    } else if (strcmp(tag, "TRACK:END") == 0) {
+        playlist_track(p, t);
+        reset_track(t);
+    }
+}
+
+/* binary dumps arrive a whole playlist at a time */
+static int
+convert_binary(FILE *fp)
+{
+    struct raw_reader r;
+    struct raw_playlist *pl;
+    struct track view;
+    uint32_t i, k;
+    int rv;
+
+    if (raw_reader_init(&r, fp) != 0) {
+        fprintf(stderr, "px2xspf: bad binary header\n");
+        return -1;
+    }
+
+    memset(&view, 0, sizeof(view));
+    while ((rv = raw_read_playlist(&r, &pl)) == 1) {
+        struct playlist *p = playlist_begin(pl->uri ? pl->uri : "", pl->name ? pl->name : "");
+
+        set(&p->owner, pl->owner);
+        set(&p->description, pl->description);
+
+        for (i = 0; i < pl->num_tracks; i++) {
+            struct raw_track *rt = &pl->tracks[i];
+            char duration[16], epoch[16];
+
+            snprintf(duration, sizeof(duration), "%u", rt->duration);
+            snprintf(epoch, sizeof(epoch), "%d", rt->epoch);
+
+            /* borrow the reader's strings; view is never reset */
+            view.index = rt->index;
+            view.creator = (char *)rt->creator;
+            view.uri = (char *)rt->uri;
+            view.name = (char *)rt->name;
+            view.duration = duration;
+            view.epoch = epoch;
+            view.album_uri = (char *)rt->album_uri;
+            view.album_name = (char *)rt->album_name;
+            view.num_artists = 0;
+            for (k = 0; k < rt->num_artists; k++) {
+                struct artist *a = track_artist(&view, k);
+                a->uri = (char *)pl->artists[rt->first_artist + k].uri;
+                a->name = (char *)pl->artists[rt->first_artist + k].name;
+            }
+            playlist_track(p, &view);
+        }
+        playlist_end(p, !(pl->flags & RAW_INCOMPLETE));
+    }
+    free(view.artists);
+    raw_reader_free(&r);
+
+    if (rv < 0) {
+        fprintf(stderr, "px2xspf: truncated or corrupt binary record\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "usage: %s [-d <directory>] < pl.raw\n", progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != EOF) {
+        switch (opt) {
+        case 'd':
+            g_dir = optarg;
+            break;
+
+        default:
+            usage(basename(argv[0]));
+            exit(1);
+        }
+    }
+
+    g_track.index = -1;
+
+    if (raw_is_binary(stdin)) {
+        return convert_binary(stdin) == 0 ? 0 : 1;
+    }
+
+    while ((len = getline(&line, &cap, stdin)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        parse_line(line);
+    }
+    free(line);
+
+    while (g_num_open) {
+        playlist_discard(g_open[0]);
+    }
+
+    return 0;
+}
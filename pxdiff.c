@@ -0,0 +1,812 @@
+/*
+ * pxdiff - report what changed between two px dumps.
+ *
+ * Each dump is read in one pass, text or binary, on a thread of its own.
+ * A playlist is kept only as its URI, its name and the hashes of its track
+ * URIs in order, with each distinct track URI stored once per dump for the
+ * report, so memory is a few bytes per track rather than the size of the
+ * dump.  Playlists are matched by URI.  Those whose track count and
+ * sequence hash agree are unchanged and cost nothing more; the rest are
+ * diffed on a pool of threads (-j) with Myers' linear space O(ND) LCS, and
+ * a track that is both removed and inserted is reported as moved.  Reports
+ * are printed in the new dump's order, so the output is the same however
+ * the threads are scheduled.
+ *
+ * Output, one line per change:
+ *
+ *   PLAYLIST:ADDED <uri> <tracks> <name>
+ *   PLAYLIST:REMOVED <uri> <tracks> <name>
+ *   PLAYLIST:RENAMED <uri> <name>
+ *   PLAYLIST:CHANGED <uri> <old tracks> <new tracks> <name>
+ *   PLAYLIST:DUPLICATE old|new <uri> <tracks> <name>
+ *   PLAYLIST:INCOMPLETE old|new <uri> <tracks> <name>
+ *   TRACK:REMOVED <playlist uri> <old position> <track uri>
+ *   TRACK:ADDED <playlist uri> <new position> <track uri>
+ *   TRACK:MOVED <playlist uri> <old position> <new position> <track uri>
+ *
+ * Positions count the tracks present in the dump, from 0.  A playlist
+ * dumped with some tracks left out because they never loaded is reported
+ * as incomplete, ahead of anything else about it, and tracks missing from
+ * an incomplete copy aren't reported as removed (or, in the old dump, the
+ * others as added).  A URI dumped more than once in the same dump, as a
+ * resumed run does with playlists it fetches again, is matched by its
+ * last complete copy, or its last copy if none is complete, and every
+ * other copy is reported as a duplicate of that dump rather than diffed.
+ * The exit status is 0 if the dumps match, 1 if they differ and 2 on
+ * trouble; duplicates and incompleteness alone are not a difference.
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pl-buf.h"
+#include "pl-raw.h"
+
+#define NONE UINT32_MAX
+
+/// Edit distance past which a range is reported as replaced outright
+#define MAX_COST 4096
+
+struct dump_playlist {
+    char *uri;
+    char *name;
+    char *ref;              /* text dumps, while the playlist is open */
+    uint64_t *hashes;       /* of each track URI, in order */
+    uint32_t *tracks;       /* each track URI's offset in strings */
+    uint32_t num_tracks, max_tracks;
+    uint64_t seq;           /* hash of hashes[] */
+    uint32_t partner;       /* matching playlist in the other dump */
+    int dup;                /* another copy of this URI is the one matched */
+    int incomplete;         /* some tracks were left out of the dump */
+};
+
+struct dump {
+    const char *path;
+    struct dump_playlist *pls;
+    uint32_t num_pls, max_pls;
+
+    /* distinct track URIs, with an open addressing index by hash */
+    struct pl_buf strings;
+    uint64_t *slot_hash;
+    uint32_t *slot_off;
+    size_t slots_cap, slots_used;
+
+    /* text playlists between PLAYLIST and PLAYLIST:END */
+    uint32_t *open;
+    int num_open, max_open;
+
+    size_t tracks;
+    int no_uris;            /* an old text dump without PLAYLIST:URI */
+    int error;
+};
+
+/* a changed playlist and the report for it */
+struct job {
+    uint32_t new, old;
+    struct pl_buf out;
+    size_t added, removed, moved;
+};
+
+static struct dump g_old, g_new;
+static struct job *g_jobs;
+static uint32_t g_num_jobs;
+static uint32_t g_next_job;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (p == NULL && n) {
+        fprintf(stderr, "pxdiff: out of memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+static uint64_t
+hash_string(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* --------------------------------  READING  ------------------------------ */
+
+/* offset of uri in d->strings, stored once per dump */
+static uint32_t
+intern(struct dump *d, const char *uri, uint64_t h)
+{
+    size_t i, mask;
+    uint32_t off;
+
+    if (2 * (d->slots_used + 1) > d->slots_cap) {
+        uint64_t *old_hash = d->slot_hash;
+        uint32_t *old_off = d->slot_off;
+        size_t old_cap = d->slots_cap;
+
+        d->slots_cap = old_cap ? 2 * old_cap : 1024;
+        d->slot_hash = xrealloc(NULL, d->slots_cap * sizeof(*d->slot_hash));
+        d->slot_off = xrealloc(NULL, d->slots_cap * sizeof(*d->slot_off));
+        memset(d->slot_off, 0xff, d->slots_cap * sizeof(*d->slot_off));
+        mask = d->slots_cap - 1;
+        for (i = 0; i < old_cap; i++) {
+            if (old_off[i] != NONE) {
+                size_t j = old_hash[i] & mask;
+                while (d->slot_off[j] != NONE) {
+                    j = (j + 1) & mask;
+                }
+                d->slot_hash[j] = old_hash[i];
+                d->slot_off[j] = old_off[i];
+            }
+        }
+        free(old_hash);
+        free(old_off);
+    }
+
+    mask = d->slots_cap - 1;
+    for (i = h & mask; d->slot_off[i] != NONE; i = (i + 1) & mask) {
+        if (d->slot_hash[i] == h && strcmp(d->strings.data + d->slot_off[i], uri) == 0) {
+            return d->slot_off[i];
+        }
+    }
+    off = d->strings.len;
+    buf_append(&d->strings, uri, strlen(uri) + 1);
+    d->slot_hash[i] = h;
+    d->slot_off[i] = off;
+    d->slots_used++;
+    return off;
+}
+
+static uint32_t
+add_playlist(struct dump *d, const char *uri, const char *name)
+{
+    struct dump_playlist *p;
+
+    if (d->num_pls == d->max_pls) {
+        d->max_pls = d->max_pls ? 2 * d->max_pls : 256;
+        d->pls = xrealloc(d->pls, d->max_pls * sizeof(*d->pls));
+    }
+    p = &d->pls[d->num_pls];
+    memset(p, 0, sizeof(*p));
+    p->uri = uri ? strdup(uri) : NULL;
+    p->name = strdup(name ? name : "");
+    p->partner = NONE;
+    return d->num_pls++;
+}
+
+static void
+add_track(struct dump *d, struct dump_playlist *p, const char *uri)
+{
+    uint64_t h = hash_string(uri);
+
+    if (p->num_tracks == p->max_tracks) {
+        p->max_tracks = p->max_tracks ? 2 * p->max_tracks : 64;
+        p->hashes = xrealloc(p->hashes, p->max_tracks * sizeof(*p->hashes));
+        p->tracks = xrealloc(p->tracks, p->max_tracks * sizeof(*p->tracks));
+    }
+    p->hashes[p->num_tracks] = h;
+    p->tracks[p->num_tracks] = intern(d, uri, h);
+    p->num_tracks++;
+    p->seq = (p->seq ^ h) * 1099511628211ULL;
+    d->tracks++;
+}
+
+/* the open text playlist with this ref, or NONE */
+static uint32_t
+find_open(struct dump *d, const char *ref, int *slot)
+{
+    int i;
+
+    for (i = d->num_open - 1; i >= 0; i--) {
+        if (strcmp(d->pls[d->open[i]].ref, ref) == 0) {
+            *slot = i;
+            return d->open[i];
+        }
+    }
+    return NONE;
+}
+
+static void
+close_open(struct dump *d, int slot)
+{
+    struct dump_playlist *p = &d->pls[d->open[slot]];
+
+    free(p->ref);
+    p->ref = NULL;
+    if (p->uri == NULL) {
+        /* dumps from before PLAYLIST:URI can only be matched by name */
+        p->uri = strdup(p->name);
+        d->no_uris = 1;
+    }
+    d->open[slot] = d->open[--d->num_open];
+}
+
+/* split off the next space separated word, returning the remainder */
+static char *
+word(char **s)
+{
+    char *w = *s, *sp;
+
+    if (w == NULL) {
+        return NULL;
+    }
+    sp = strchr(w, ' ');
+    if (sp) {
+        *sp = '\0';
+        *s = sp + 1;
+    } else {
+        *s = NULL;
+    }
+    return w;
+}
+
+static void
+parse_line(struct dump *d, char *line)
+{
+    char *rest = line;
+    char *tag = word(&rest);
+    char *ref = word(&rest);
+    uint32_t p;
+    int slot;
+
+    if (tag == NULL || ref == NULL) {
+        return;
+    }
+
+    if (strcmp(tag, "PLAYLIST") == 0) {
+        if (find_open(d, ref, &slot) != NONE) {
+            close_open(d, slot);
+        }
+        word(&rest); /* track count */
+        p = add_playlist(d, NULL, rest);
+        d->pls[p].ref = strdup(ref);
+        if (d->num_open == d->max_open) {
+            d->max_open = d->max_open ? 2 * d->max_open : 16;
+            d->open = xrealloc(d->open, d->max_open * sizeof(*d->open));
+        }
+        d->open[d->num_open++] = p;
+        return;
+    }
+    if (tag[0] != 'P' && strcmp(tag, "TRACK:URI") != 0) {
+        return;
+    }
+    if ((p = find_open(d, ref, &slot)) == NONE) {
+        return;
+    }
+    if (strcmp(tag, "TRACK:URI") == 0) {
+        word(&rest); /* index */
+        add_track(d, &d->pls[p], rest ? rest : "");
+    } else if (strcmp(tag, "PLAYLIST:URI") == 0 && rest) {
+        free(d->pls[p].uri);
+        d->pls[p].uri = strdup(rest);
+    } else if (strcmp(tag, "PLAYLIST:END") == 0) {
+        d->pls[p].incomplete = rest && strcmp(rest, "incomplete") == 0;
+        close_open(d, slot);
+    }
+}
+
+static int
+read_text(struct dump *d, FILE *fp)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        parse_line(d, line);
+    }
+    free(line);
+
+    if (d->num_open) {
+        fprintf(stderr, "pxdiff: %s: %d playlists have no PLAYLIST:END\n",
+                d->path, d->num_open);
+        while (d->num_open) {
+            close_open(d, 0);
+        }
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+static int
+read_binary(struct dump *d, FILE *fp)
+{
+    struct raw_reader r;
+    struct raw_playlist *pl;
+    uint32_t i, p;
+    int rv;
+
+    if (raw_reader_init(&r, fp) != 0) {
+        fprintf(stderr, "pxdiff: %s: bad binary header\n", d->path);
+        return -1;
+    }
+    while ((rv = raw_read_playlist(&r, &pl)) == 1) {
+        p = add_playlist(d, pl->uri ? pl->uri : "", pl->name);
+        d->pls[p].incomplete = (pl->flags & RAW_INCOMPLETE) != 0;
+        for (i = 0; i < pl->num_tracks; i++) {
+            add_track(d, &d->pls[p], pl->tracks[i].uri ? pl->tracks[i].uri : "");
+        }
+    }
+    raw_reader_free(&r);
+    if (rv < 0) {
+        fprintf(stderr, "pxdiff: %s: truncated or corrupt binary record\n", d->path);
+        return -1;
+    }
+    return 0;
+}
+
+static void *
+read_dump(void *arg)
+{
+    struct dump *d = arg;
+    FILE *fp = fopen(d->path, "r");
+
+    if (fp == NULL) {
+        fprintf(stderr, "pxdiff: %s: %s\n", d->path, strerror(errno));
+        d->error = 1;
+        return NULL;
+    }
+    buf_init(&d->strings, 64 * 1024);
+    if ((raw_is_binary(fp) ? read_binary(d, fp) : read_text(d, fp)) != 0) {
+        d->error = 1;
+    }
+    fclose(fp);
+    return NULL;
+}
+
+/* -------------------------------  MATCHING  ------------------------------ */
+
+/*
+ * Index a dump's playlists by URI in an open addressing table of cap
+ * slots.  Of several copies of a URI the last complete one is indexed,
+ * or the last one if none is complete, and the rest are flagged as
+ * duplicates.
+ */
+static uint32_t *
+index_uris(struct dump *d, size_t cap)
+{
+    size_t mask = cap - 1, i;
+    uint32_t *slots = xrealloc(NULL, cap * sizeof(*slots)), k;
+
+    memset(slots, 0xff, cap * sizeof(*slots));
+    for (k = 0; k < d->num_pls; k++) {
+        struct dump_playlist *p = &d->pls[k];
+
+        for (i = hash_string(p->uri) & mask; slots[i] != NONE; i = (i + 1) & mask) {
+            if (strcmp(d->pls[slots[i]].uri, p->uri) == 0) {
+                break;
+            }
+        }
+        if (slots[i] == NONE) {
+            slots[i] = k;
+        } else if (!p->incomplete || d->pls[slots[i]].incomplete) {
+            d->pls[slots[i]].dup = 1;
+            slots[i] = k;
+        } else {
+            p->dup = 1;
+        }
+    }
+    return slots;
+}
+
+/* pair each new playlist with the old one of the same URI */
+static void
+match_playlists(void)
+{
+    size_t cap = 64, mask, i;
+    uint32_t *old_slots, *new_slots, k;
+
+    while (cap < 2 * (size_t)g_old.num_pls || cap < 2 * (size_t)g_new.num_pls) {
+        cap *= 2;
+    }
+    mask = cap - 1;
+    old_slots = index_uris(&g_old, cap);
+    new_slots = index_uris(&g_new, cap); /* only to flag duplicates */
+
+    for (k = 0; k < g_new.num_pls; k++) {
+        struct dump_playlist *p = &g_new.pls[k];
+        if (p->dup) {
+            continue;
+        }
+        for (i = hash_string(p->uri) & mask; old_slots[i] != NONE; i = (i + 1) & mask) {
+            struct dump_playlist *o = &g_old.pls[old_slots[i]];
+            if (strcmp(o->uri, p->uri) == 0) {
+                p->partner = old_slots[i];
+                o->partner = k;
+                break;
+            }
+        }
+    }
+    free(old_slots);
+    free(new_slots);
+}
+
+/* --------------------------------  DIFFING  ------------------------------ */
+
+/* one LCS run: sequences, the work arrays and the edit script so far */
+struct lcs {
+    const uint64_t *a, *b;
+    long *vf, *vb;
+    uint32_t *del, *ins;
+    uint32_t num_del, num_ins;
+};
+
+/*
+ * Find the middle snake of a[a0, a1) against b[b0, b1): the run of matches
+ * crossed by an optimal path halfway along it.  Both ranges are non-empty
+ * and differ in their first and last elements.  Sets the snake as [*x, *u)
+ * of a and [*y, *v) of b and returns 0, or returns -1 if the paths haven't
+ * met after MAX_COST steps each way.
+ */
+static int
+middle_snake(struct lcs *s, long a0, long a1, long b0, long b1,
+             long *x, long *y, long *u, long *v)
+{
+    long n = a1 - a0, m = b1 - b0, delta = n - m, max = (n + m + 1) / 2;
+    long *vf = s->vf + max + 1, *vb = s->vb + max + 1;
+    int odd = delta & 1;
+    long d, k, px, py;
+
+    vf[1] = 0;
+    vb[1] = 0;
+    for (d = 0; d <= max; d++) {
+        if (d > MAX_COST) {
+            return -1;
+        }
+        /* forward from the start */
+        for (k = -d; k <= d; k += 2) {
+            px = (k == -d || (k != d && vf[k - 1] < vf[k + 1])) ? vf[k + 1] : vf[k - 1] + 1;
+            py = px - k;
+            *x = px;
+            *y = py;
+            while (px < n && py < m && s->a[a0 + px] == s->b[b0 + py]) {
+                px++;
+                py++;
+            }
+            vf[k] = px;
+            if (odd && delta - k >= -(d - 1) && delta - k <= d - 1 && px + vb[delta - k] >= n) {
+                *x += a0;
+                *y += b0;
+                *u = a0 + px;
+                *v = b0 + py;
+                return 0;
+            }
+        }
+        /* backward from the end, in reversed coordinates */
+        for (k = -d; k <= d; k += 2) {
+            px = (k == -d || (k != d && vb[k - 1] < vb[k + 1])) ? vb[k + 1] : vb[k - 1] + 1;
+            py = px - k;
+            *u = a1 - px;
+            *v = b1 - py;
+            while (px < n && py < m && s->a[a1 - 1 - px] == s->b[b1 - 1 - py]) {
+                px++;
+                py++;
+            }
+            vb[k] = px;
+            if (!odd && delta - k >= -d && delta - k <= d && px + vf[delta - k] >= n) {
+                *x = a1 - px;
+                *y = b1 - py;
+                return 0;
+            }
+        }
+    }
+    /* unreachable: the paths always meet by d = max */
+    return -1;
+}
+
+static void
+lcs(struct lcs *s, long a0, long a1, long b0, long b1)
+{
+    long x, y, u, v;
+
+    while (a0 < a1 && b0 < b1 && s->a[a0] == s->b[b0]) {
+        a0++;
+        b0++;
+    }
+    while (a0 < a1 && b0 < b1 && s->a[a1 - 1] == s->b[b1 - 1]) {
+        a1--;
+        b1--;
+    }
+    /*
+     * Too far apart to be worth an exact answer, as when a long playlist
+     * is shuffled: everything is removed and inserted again, and the
+     * pairing in diff_playlist reports the tracks as moved.
+     */
+    if (a0 == a1 || b0 == b1 || middle_snake(s, a0, a1, b0, b1, &x, &y, &u, &v) != 0) {
+        while (a0 < a1) {
+            s->del[s->num_del++] = a0++;
+        }
+        while (b0 < b1) {
+            s->ins[s->num_ins++] = b0++;
+        }
+        return;
+    }
+    lcs(s, a0, x, b0, y);
+    lcs(s, u, a1, v, b1);
+}
+
+/* a removed or inserted track, sorted by hash to pair up moves */
+struct edit {
+    uint64_t hash;
+    uint32_t pos;
+};
+
+static int
+by_hash(const void *pa, const void *pb)
+{
+    const struct edit *a = pa, *b = pb;
+
+    if (a->hash != b->hash) {
+        return a->hash < b->hash ? -1 : 1;
+    }
+    return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+static struct edit *
+edits(const uint32_t *pos, uint32_t n, const uint64_t *hashes)
+{
+    struct edit *e = xrealloc(NULL, (n + 1) * sizeof(*e));
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        e[i].hash = hashes[pos[i]];
+        e[i].pos = pos[i];
+    }
+    qsort(e, n, sizeof(*e), by_hash);
+    return e;
+}
+
+static void
+diff_playlist(struct job *j)
+{
+    struct dump_playlist *o = &g_old.pls[j->old], *p = &g_new.pls[j->new];
+    size_t max = (o->num_tracks + p->num_tracks + 1) / 2 + 2;
+    uint32_t *moved_from, *moved_to;
+    struct edit *de, *ie;
+    struct lcs s;
+    uint32_t i, k;
+
+    buf_init(&j->out, 4096);
+    if (o->seq == p->seq && o->num_tracks == p->num_tracks) {
+        buf_printf(&j->out, "PLAYLIST:RENAMED %s %s\n", p->uri, p->name);
+        return;
+    }
+    buf_printf(&j->out, "PLAYLIST:CHANGED %s %u %u %s\n", p->uri,
+               o->num_tracks, p->num_tracks, p->name);
+
+    s.a = o->hashes;
+    s.b = p->hashes;
+    s.vf = xrealloc(NULL, 2 * max * sizeof(*s.vf));
+    s.vb = xrealloc(NULL, 2 * max * sizeof(*s.vb));
+    s.del = xrealloc(NULL, (o->num_tracks + 1) * sizeof(*s.del));
+    s.ins = xrealloc(NULL, (p->num_tracks + 1) * sizeof(*s.ins));
+    s.num_del = s.num_ins = 0;
+    lcs(&s, 0, o->num_tracks, 0, p->num_tracks);
+    free(s.vf);
+    free(s.vb);
+
+    /* a track removed in one place and inserted in another has moved */
+    de = edits(s.del, s.num_del, o->hashes);
+    ie = edits(s.ins, s.num_ins, p->hashes);
+    moved_from = xrealloc(NULL, (p->num_tracks + 1) * sizeof(*moved_from));
+    moved_to = xrealloc(NULL, (o->num_tracks + 1) * sizeof(*moved_to));
+    for (i = 0; i < s.num_ins; i++) {
+        moved_from[s.ins[i]] = NONE;
+    }
+    for (i = 0; i < s.num_del; i++) {
+        moved_to[s.del[i]] = NONE;
+    }
+    for (i = k = 0; i < s.num_del && k < s.num_ins; ) {
+        if (de[i].hash < ie[k].hash) {
+            i++;
+        } else if (ie[k].hash < de[i].hash) {
+            k++;
+        } else {
+            moved_from[ie[k].pos] = de[i].pos;
+            moved_to[de[i].pos] = ie[k].pos;
+            i++;
+            k++;
+        }
+    }
+
+    /* a track missing from an incomplete copy may just not have loaded */
+    for (i = 0; i < s.num_del; i++) {
+        uint32_t a = s.del[i];
+        if (moved_to[a] == NONE && !p->incomplete) {
+            buf_printf(&j->out, "TRACK:REMOVED %s %u %s\n", p->uri, a,
+                       g_old.strings.data + o->tracks[a]);
+            j->removed++;
+        }
+    }
+    for (i = 0; i < s.num_ins; i++) {
+        uint32_t b = s.ins[i];
+        if (moved_from[b] == NONE && o->incomplete) {
+            continue;
+        } else if (moved_from[b] == NONE) {
+            buf_printf(&j->out, "TRACK:ADDED %s %u %s\n", p->uri, b,
+                       g_new.strings.data + p->tracks[b]);
+            j->added++;
+        } else {
+            buf_printf(&j->out, "TRACK:MOVED %s %u %u %s\n", p->uri, moved_from[b], b,
+                       g_new.strings.data + p->tracks[b]);
+            j->moved++;
+        }
+    }
+
+    free(s.del);
+    free(s.ins);
+    free(de);
+    free(ie);
+    free(moved_from);
+    free(moved_to);
+}
+
+static void *
+diff_worker(void *arg)
+{
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&g_next_job, 1, __ATOMIC_RELAXED)) < g_num_jobs) {
+        diff_playlist(&g_jobs[i]);
+    }
+    return NULL;
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "usage: %s [-j <threads>] <old pl.raw> <new pl.raw>\n", progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t reader, *workers;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t added = 0, removed = 0, moved = 0, new_pls = 0, gone_pls = 0, same = 0, dups = 0;
+    size_t incomplete = 0;
+    double t0, t1, t2;
+    struct dump_playlist *o;
+    uint32_t i, n = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:")) != EOF) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+
+        default:
+            usage(basename(argv[0]));
+            exit(2);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(basename(argv[0]));
+        exit(2);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    /* the dumps are independent, so read them side by side */
+    t0 = now();
+    g_old.path = argv[optind];
+    g_new.path = argv[optind + 1];
+    pthread_create(&reader, NULL, read_dump, &g_old);
+    read_dump(&g_new);
+    pthread_join(reader, NULL);
+    if (g_old.error || g_new.error) {
+        exit(2);
+    }
+    if (g_old.no_uris || g_new.no_uris) {
+        fprintf(stderr, "pxdiff: no PLAYLIST:URI records, matching playlists by name\n");
+    }
+
+    t1 = now();
+    match_playlists();
+    g_jobs = xrealloc(NULL, (g_new.num_pls + 1) * sizeof(*g_jobs));
+    for (i = 0; i < g_new.num_pls; i++) {
+        struct dump_playlist *p = &g_new.pls[i], *o;
+        if (p->partner == NONE) {
+            continue;
+        }
+        o = &g_old.pls[p->partner];
+        if (o->seq == p->seq && o->num_tracks == p->num_tracks && strcmp(o->name, p->name) == 0) {
+            same++;
+            continue;
+        }
+        memset(&g_jobs[g_num_jobs], 0, sizeof(*g_jobs));
+        g_jobs[g_num_jobs].new = i;
+        g_jobs[g_num_jobs].old = p->partner;
+        g_num_jobs++;
+    }
+
+    if (threads > g_num_jobs) {
+        threads = g_num_jobs ? g_num_jobs : 1;
+    }
+    workers = xrealloc(NULL, threads * sizeof(*workers));
+    for (i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, diff_worker, NULL);
+    }
+    diff_worker(NULL);
+    for (i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    t2 = now();
+
+    /* in the new dump's order, with removed playlists last */
+    for (i = 0; i < g_new.num_pls; i++) {
+        struct dump_playlist *p = &g_new.pls[i];
+        if (p->incomplete && !p->dup) {
+            printf("PLAYLIST:INCOMPLETE new %s %u %s\n", p->uri, p->num_tracks, p->name);
+            incomplete++;
+        }
+        if (p->partner != NONE && g_old.pls[p->partner].incomplete) {
+            o = &g_old.pls[p->partner];
+            printf("PLAYLIST:INCOMPLETE old %s %u %s\n", o->uri, o->num_tracks, o->name);
+            incomplete++;
+        }
+        if (p->dup) {
+            printf("PLAYLIST:DUPLICATE new %s %u %s\n", p->uri, p->num_tracks, p->name);
+            dups++;
+        } else if (p->partner == NONE) {
+            printf("PLAYLIST:ADDED %s %u %s\n", p->uri, p->num_tracks, p->name);
+            new_pls++;
+        } else if (n < g_num_jobs && g_jobs[n].new == i) {
+            fwrite(g_jobs[n].out.data, 1, g_jobs[n].out.len, stdout);
+            added += g_jobs[n].added;
+            removed += g_jobs[n].removed;
+            moved += g_jobs[n].moved;
+            buf_free(&g_jobs[n].out);
+            n++;
+        }
+    }
+    for (i = 0; i < g_old.num_pls; i++) {
+        o = &g_old.pls[i];
+        if (o->incomplete && !o->dup && o->partner == NONE) {
+            printf("PLAYLIST:INCOMPLETE old %s %u %s\n", o->uri, o->num_tracks, o->name);
+            incomplete++;
+        }
+        if (o->dup) {
+            printf("PLAYLIST:DUPLICATE old %s %u %s\n", o->uri, o->num_tracks, o->name);
+            dups++;
+        } else if (o->partner == NONE) {
+            printf("PLAYLIST:REMOVED %s %u %s\n", o->uri, o->num_tracks, o->name);
+            gone_pls++;
+        }
+    }
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "pxdiff: write: %s\n", strerror(errno));
+        exit(2);
+    }
+
+    fprintf(stderr, "PXDIFF playlists old=%u new=%u same=%zu changed=%u added=%zu removed=%zu "
+            "duplicates=%zu incomplete=%zu tracks old=%zu new=%zu added=%zu removed=%zu moved=%zu "
+            "read_s=%.3f diff_s=%.3f threads=%ld\n",
+            g_old.num_pls, g_new.num_pls, same, g_num_jobs, new_pls, gone_pls, dups, incomplete,
+            g_old.tracks, g_new.tracks, added, removed, moved, t1 - t0, t2 - t1, threads);
+
+    return g_num_jobs || new_pls || gone_pls ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * queue-bench - time the pl-queue operations px performs, at a size well
+ * past any real rootlist.
+ *
+ *     ./mdo queue-bench && ./queue-bench [entries]
+ *
+ * Playlists are fake pointers, never dereferenced: sp_playlist_name is
+ * stubbed out below and the queue's debug output goes to /dev/null.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <libspotify/api.h>
+
+#include "pl-queue.h"
+
+#define DEFAULT_ENTRIES 100000
+
+const char *
+sp_playlist_name(sp_playlist *playlist)
+{
+    return "";
+}
+
+static sp_playlist *
+fake(int i)
+{
+    return (sp_playlist *)(uintptr_t)(16 * (i + 1));
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *what, int ops, double t0)
+{
+    double s = now() - t0;
+    printf("queue-bench: %-24s %8d ops %9.3f ms %8.1f ns/op\n", what, ops, s * 1e3, s * 1e9 / ops);
+}
+
+static int
+odd(sp_playlist *pl)
+{
+    return ((uintptr_t)pl / 16) & 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : DEFAULT_ENTRIES;
+    int *order = malloc(n * sizeof(*order));
+    struct rusage ru;
+    double t0;
+    int i, found;
+
+    if (freopen("/dev/null", "w", stderr) == NULL) {
+        return 1;
+    }
+    init_playlist_queues();
+
+    /* shuffled order for removals, so nothing benefits from list order */
+    srand(1);
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1), tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        if (i % 10 == 0) {
+            queue_pending_first(fake(i));
+        } else {
+            queue_pending(fake(i), order[i] % 1000);
+        }
+    }
+    report("queue_pending", n, t0);
+
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        queue_working(dequeue_pending());
+    }
+    report("dequeue+queue_working", n, t0);
+
+    t0 = now();
+    for (found = 0, i = 0; i < n; i++) {
+        found += is_working(fake(order[i]));
+        found += is_working(fake(n + i));
+    }
+    report("is_working", 2 * n, t0);
+
+    t0 = now();
+    for (i = 0; i < n; i++) {
+        remove_working(fake(order[i]));
+    }
+    report("remove_working", n, t0);
+
+    for (i = 0; i < n; i++) {
+        queue_working(fake(i));
+    }
+    t0 = now();
+    deinit_finished_working(odd, remove_working);
+    report("deinit_finished_working", n, t0);
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("queue-bench: %d lookups hit, %d left working, peak RSS %ld kB\n",
+           found, num_working(), ru.ru_maxrss);
+    free(order);
+    return found == n && num_working() == n - n / 2 ? 0 : 1;
+}
@@ -0,0 +1,365 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pl-buf.h"
+#include "track-cache.h"
+
+/*
+ * Persistent cache of track metadata, keyed by track URI.
+ *
+ * The file is append-only: TC_MAGIC, then one record per track,
+ *
+ *   u32 length      bytes in the record after this field
+ *   u32 duration
+ *   u32 num_artists
+ *   NUL terminated uri, name, album_uri, album_name,
+ *   then num_artists pairs of artist uri, name
+ *
+ * little endian.  At startup the file is mapped read-only and indexed in
+ * place, so a lookup hands out pointers straight into the mapping and
+ * nothing is copied.  Tracks seen loaded during the run are appended in
+ * batches; a later record for the same URI replaces an earlier one on the
+ * next load.  A record torn by a crash fails its length check and is
+ * dropped along with anything after it.
+ */
+
+#define TC_MAGIC "PXTRK1\n"
+#define TC_MAGIC_LEN 8
+#define TC_BATCH (256 * 1024)
+
+static pthread_mutex_t g_tc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_fd = -1;
+static const char *g_map;
+static size_t g_map_len;
+
+static struct track_meta *g_slots;      /* open addressing on uri */
+static size_t g_cap, g_used;
+
+static struct pl_buf g_append;         /* records not yet written */
+static struct pl_buf g_record;         /* record being built */
+static int g_record_artists;
+static unsigned long g_loaded, g_hits, g_misses, g_stored;
+
+static uint32_t
+get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static size_t
+hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct track_meta *
+slot(const char *uri)
+{
+    size_t i;
+
+    for (i = hash(uri) & (g_cap - 1); g_slots[i].uri; i = (i + 1) & (g_cap - 1)) {
+        if (strcmp(g_slots[i].uri, uri) == 0) {
+            break;
+        }
+    }
+    return &g_slots[i];
+}
+
+static void
+insert(const struct track_meta *m)
+{
+    struct track_meta *s;
+
+    if (2 * (g_used + 1) > g_cap) {
+        struct track_meta *old = g_slots;
+        size_t old_cap = g_cap, i;
+
+        g_cap = old_cap ? 2 * old_cap : 4096;
+        g_slots = calloc(g_cap, sizeof(*g_slots));
+        if (g_slots == NULL) {
+            fprintf(stderr, "track-cache: out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < old_cap; i++) {
+            if (old[i].uri) {
+                *slot(old[i].uri) = old[i];
+            }
+        }
+        free(old);
+    }
+    s = slot(m->uri);
+    if (s->uri == NULL) {
+        g_used++;
+    }
+    *s = *m;
+}
+
+/* next NUL terminated string in [*p, end), or NULL */
+static const char *
+next_string(const char **p, const char *end)
+{
+    const char *s = *p, *nul = memchr(s, '\0', end - s);
+
+    if (nul == NULL) {
+        return NULL;
+    }
+    *p = nul + 1;
+    return s;
+}
+
+/* decode the record at rec, len bytes including its length word */
+static int
+parse(const char *rec, size_t len, struct track_meta *m)
+{
+    const char *p = rec + 12, *end = rec + len;
+    int i;
+
+    m->record = rec;
+    m->len = len;
+    m->duration = get32((const unsigned char *)rec + 4);
+    m->num_artists = get32((const unsigned char *)rec + 8);
+    if (!(m->uri = next_string(&p, end)) || !(m->name = next_string(&p, end)) ||
+        !(m->album_uri = next_string(&p, end)) || !(m->album_name = next_string(&p, end))) {
+        return -1;
+    }
+    m->artists = p;
+    for (i = 0; i < 2 * m->num_artists; i++) {
+        if (!next_string(&p, end)) {
+            return -1;
+        }
+    }
+    return p == end ? 0 : -1;
+}
+
+/**
+ * Map and index the cache at path, creating it if needed.  Tracks loaded
+ * during the run are appended to it.
+ */
+int
+track_cache_open(const char *path)
+{
+    struct stat st;
+    size_t off;
+
+    g_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (g_fd < 0 || fstat(g_fd, &st) != 0) {
+        fprintf(stderr, "track cache %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    buf_init(&g_append, TC_BATCH);
+
+    if (st.st_size == 0) {
+        buf_append(&g_append, TC_MAGIC, TC_MAGIC_LEN);
+        return 0;
+    }
+
+    g_map_len = st.st_size;
+    g_map = mmap(NULL, g_map_len, PROT_READ, MAP_SHARED, g_fd, 0);
+    if (g_map == MAP_FAILED || g_map_len < TC_MAGIC_LEN ||
+        memcmp(g_map, TC_MAGIC, TC_MAGIC_LEN) != 0) {
+        fprintf(stderr, "track cache %s: not a track cache\n", path);
+        close(g_fd);
+        g_fd = -1;
+        return -1;
+    }
+
+    for (off = TC_MAGIC_LEN; off + 4 <= g_map_len; ) {
+        uint32_t len = get32((const unsigned char *)g_map + off);
+        struct track_meta m;
+
+        if (len < 8 || len > g_map_len - off - 4 || parse(g_map + off, 4 + len, &m) != 0) {
+            fprintf(stderr, "track cache %s: dropping %zu torn bytes\n", path, g_map_len - off);
+            if (ftruncate(g_fd, off) != 0) {
+                fprintf(stderr, "track cache %s: %s\n", path, strerror(errno));
+            }
+            break;
+        }
+        insert(&m);
+        off += 4 + len;
+    }
+    fprintf(stderr, "TC %zu tracks cached in %s\n", g_used, path);
+    return 0;
+}
+
+/* the cached track, valid until the next track_cache_end */
+const struct track_meta *
+track_cache_get(const char *uri)
+{
+    struct track_meta *m;
+
+    if (g_cap == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&g_tc_mutex);
+    m = slot(uri);
+    pthread_mutex_unlock(&g_tc_mutex);
+    return m->uri ? m : NULL;
+}
+
+/* artist i of a cached track: returns its uri and sets *name */
+const char *
+track_meta_artist(const struct track_meta *m, int i, const char **name)
+{
+    const char *p = m->artists;
+
+    for (i = 2 * i; i > 0; i--) {
+        p += strlen(p) + 1;
+    }
+    *name = p + strlen(p) + 1;
+    return p;
+}
+
+static void
+flush_appends(void)
+{
+    if (g_append.len && buf_flush(&g_append, g_fd) != 0) {
+        fprintf(stderr, "track cache: %s\n", strerror(errno));
+        g_append.len = 0;
+    }
+}
+
+static void
+append_string(const char *s)
+{
+    buf_append(&g_record, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+/*
+ * Remember a loaded track: track_cache_begin, track_cache_artist for each
+ * artist, then track_cache_end.  Main thread only.
+ */
+void
+track_cache_begin(const char *uri, const char *name, int duration,
+                  const char *album_uri, const char *album_name)
+{
+    unsigned char h[12] = { 0 };
+
+    if (g_fd < 0) {
+        return;
+    }
+    if (g_record.cap == 0) {
+        buf_init(&g_record, 1024);
+    }
+    g_record.len = 0;
+    g_record_artists = 0;
+    put32(h + 4, duration);
+    buf_append(&g_record, h, sizeof(h));
+    append_string(uri);
+    append_string(name);
+    append_string(album_uri);
+    append_string(album_name);
+}
+
+void
+track_cache_artist(const char *uri, const char *name)
+{
+    if (g_fd < 0) {
+        return;
+    }
+    append_string(uri);
+    append_string(name);
+    g_record_artists++;
+}
+
+/* append the record unless the cache already has it exactly */
+void
+track_cache_end(void)
+{
+    const struct track_meta *old;
+    struct track_meta m;
+    char *copy;
+
+    if (g_fd < 0) {
+        return;
+    }
+    put32((unsigned char *)g_record.data, g_record.len - 4);
+    put32((unsigned char *)g_record.data + 8, g_record_artists);
+
+    pthread_mutex_lock(&g_tc_mutex);
+    old = g_cap ? slot(g_record.data + 12) : NULL;
+    if (old && old->uri && old->len == g_record.len &&
+        memcmp(old->record, g_record.data, g_record.len) == 0) {
+        pthread_mutex_unlock(&g_tc_mutex);
+        return;
+    }
+
+    /* index a private copy, so a track shared by playlists is stored once */
+    copy = malloc(g_record.len);
+    if (copy == NULL) {
+        fprintf(stderr, "track-cache: out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, g_record.data, g_record.len);
+    if (parse(copy, g_record.len, &m) == 0) {
+        insert(&m);
+    } else {
+        free(copy);
+    }
+    buf_append(&g_append, g_record.data, g_record.len);
+    g_stored++;
+    if (g_append.len >= TC_BATCH) {
+        flush_appends();
+    }
+    pthread_mutex_unlock(&g_tc_mutex);
+}
+
+/* tally one track written out: loaded by libspotify, or from the cache */
+void
+track_cache_count(int loaded, int hit)
+{
+    pthread_mutex_lock(&g_tc_mutex);
+    if (loaded) {
+        g_loaded++;
+    } else if (hit) {
+        g_hits++;
+    } else {
+        g_misses++;
+    }
+    pthread_mutex_unlock(&g_tc_mutex);
+}
+
+void
+track_cache_close(void)
+{
+    pthread_mutex_lock(&g_tc_mutex);
+    if (g_fd >= 0) {
+        flush_appends();
+        close(g_fd);
+        g_fd = -1;
+    }
+    pthread_mutex_unlock(&g_tc_mutex);
+}
+
+void
+print_track_cache_stats(void)
+{
+    unsigned long lookups;
+
+    pthread_mutex_lock(&g_tc_mutex);
+    lookups = g_hits + g_misses;
+    fprintf(stderr, "TC loaded=%lu hits=%lu misses=%lu hit_rate=%.1f%% stored=%lu cached=%zu\n",
+            g_loaded, g_hits, g_misses, lookups ? 100.0 * g_hits / lookups : 0.0,
+            g_stored, g_used);
+    pthread_mutex_unlock(&g_tc_mutex);
+}
@@ -0,0 +1,23 @@
+/* a track as remembered from an earlier run, see track-cache.c */
+struct track_meta {
+    const char *uri;
+    const char *name;
+    const char *album_uri;
+    const char *album_name;
+    const char *artists;    /* num_artists pairs of NUL terminated uri, name */
+    int duration;
+    int num_artists;
+    const char *record;     /* the whole record as stored, and its length */
+    size_t len;
+};
+
+int track_cache_open(const char *path);
+const struct track_meta *track_cache_get(const char *uri);
+const char *track_meta_artist(const struct track_meta *, int i, const char **name);
+void track_cache_begin(const char *uri, const char *name, int duration,
+                       const char *album_uri, const char *album_name);
+void track_cache_artist(const char *uri, const char *name);
+void track_cache_end(void);
+void track_cache_count(int loaded, int hit);
+void track_cache_close(void);
+void print_track_cache_stats(void);